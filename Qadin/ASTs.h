@@ -17,9 +17,54 @@ As constructs, we'll allow:
 */
 
 
+/* 0. Types.
+
+Every value used to be a double, and a double is still what you get unless you
+ask for something else. The vecN types are N doubles side by side, which codegen
+maps straight onto LLVM's <N x double>, so arithmetic on them is SIMD. For those
+the enum value is the lane count.
+
+buf is an array of doubles owned by whoever calls the gate. It can only be a
+parameter, and is passed as two C arguments, a pointer and a length, so from C++
+gate f(buf a k) is double f(double *a, int64_t a_len, double k). The pointer is
+marked noalias, so it must not overlap any other buf passed to the same call.
+Indexing isn't bounds checked; use len(a).
+*/
+
+enum QType {
+    ty_buf = 0,
+    ty_double = 1,
+    ty_vec2 = 2,
+    ty_vec4 = 4,
+    ty_vec8 = 8,
+};
+
+static QType TypeFromName(const string &Name) {
+    if (Name == "vec2") return ty_vec2;
+    if (Name == "vec4") return ty_vec4;
+    if (Name == "vec8") return ty_vec8;
+    if (Name == "buf") return ty_buf;
+    return ty_double;
+}
+
+static const char *TypeName(QType Ty) {
+    switch (Ty) {
+        case ty_vec2: return "vec2";
+        case ty_vec4: return "vec4";
+        case ty_vec8: return "vec8";
+        case ty_buf: return "buf";
+        default: return "double";
+    }
+}
+
+
+class ASTWriter; // astfile.h, for saving parsed programs
+
+
 /* 1. Expressions.
 
-expr = expr op expr | num | var | func(args)
+expr = expr op expr | num | var | func(args) | if expr then expr else expr
+     | for var = expr, expr[, expr] in expr | var[expr] | var[expr] = expr
 args = expr expr | ''
 num is any number
 var and func are any string
@@ -27,13 +72,35 @@ op is yet to be defined
 
 */
 
-// Parent Class for all Expression ASTs.
+// What an ExprAST is, so code walking the tree (astdump.h) can cast without RTTI
+enum ExprKind : uint8_t {
+    expr_number,
+    expr_variable,
+    expr_binary,
+    expr_index,
+    expr_store,
+    expr_call,
+    expr_if,
+    expr_for,
+};
+
+// Parent Class for all Expression ASTs. Each knows where in the source it starts,
+// for debug info. Its kids are its subexpressions in source order, leaving out a
+// for's step when it has none
 class ExprAST {
+    SourceLocation Loc = {0, 0};
+    ExprKind Kind;
 
     public:
+        ExprAST(ExprKind Kind) : Kind(Kind) {}
         virtual ~ExprAST() {}
+        SourceLocation getLoc() const {return Loc;}
+        void setLoc(SourceLocation L) {Loc = L;}
+        ExprKind kind() const {return Kind;}
+        virtual size_t numKids() const {return 0;}
+        virtual const ExprAST *kid(size_t) const {return nullptr;}
         virtual llvm::Value *codegen() = 0;
-        virtual void pretty_print(string end) = 0;
+        virtual uint32_t serialize(ASTWriter &W) const = 0; // Returns the node's index
         
 };
 
@@ -42,11 +109,10 @@ class NumberExprAST : public ExprAST {
     double Val;
     
     public:
-        NumberExprAST(double Val) : Val(Val) {}
-        void pretty_print(string end) override {
-            printf("(Number = %f)%s", Val, end.c_str()); 
-        }
+        NumberExprAST(double Val) : ExprAST(expr_number), Val(Val) {}
+        double getVal() const {return Val;}
         llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
 };
 
 // VariableExprAST - for referencing or assigning a variable
@@ -54,11 +120,10 @@ class VariableExprAST : public ExprAST {
     string IdName;
 
     public:
-        VariableExprAST(string &IdName) : IdName(IdName) {}
-        void pretty_print(string end) override { 
-            printf("(id = %s)%s", IdName.c_str(), end.c_str()); 
-        }
+        VariableExprAST(string &IdName) : ExprAST(expr_variable), IdName(IdName) {}
+        const string &getName() const {return IdName;}
         llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
 };
 
 // Binary operations, e.g. 1 + (2 * 3). Notably left recursive, so a recursive 
@@ -69,73 +134,136 @@ class BinaryExprAST : public ExprAST {
 
     public:
         BinaryExprAST(char op, unique_ptr<ExprAST> left, unique_ptr<ExprAST> right) :
-        Op(op), left(move(left)), right(move(right)) {}
-
-        void pretty_print(string end) override { 
-            printf("Binary Expr: "); 
-            left->pretty_print(""); 
-            printf(" %c ", Op); 
-            right->pretty_print("");
-            printf("%s", end.c_str());
-        }
+        ExprAST(expr_binary), Op(op), left(move(left)), right(move(right)) {}
+
+        char getOp() const {return Op;}
+        size_t numKids() const override {return 2;}
+        const ExprAST *kid(size_t i) const override {return i ? right.get() : left.get();}
 
         llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
+};
+
+// IndexExprAST - reads one element of a buf, a[i]
+class IndexExprAST : public ExprAST {
+    string BufName;
+    unique_ptr<ExprAST> Index;
+
+    public:
+        IndexExprAST(const string &BufName, unique_ptr<ExprAST> Index) :
+        ExprAST(expr_index), BufName(BufName), Index(move(Index)) {}
+        const string &getBufName() const {return BufName;}
+        size_t numKids() const override {return 1;}
+        const ExprAST *kid(size_t) const override {return Index.get();}
+        llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
+};
+
+// StoreExprAST - writes one element of a buf, a[i] = x. Evaluates to x
+class StoreExprAST : public ExprAST {
+    string BufName;
+    unique_ptr<ExprAST> Index, Val;
+
+    public:
+        StoreExprAST(const string &BufName, unique_ptr<ExprAST> Index, unique_ptr<ExprAST> Val) :
+        ExprAST(expr_store), BufName(BufName), Index(move(Index)), Val(move(Val)) {}
+        const string &getBufName() const {return BufName;}
+        size_t numKids() const override {return 2;}
+        const ExprAST *kid(size_t i) const override {return i ? Val.get() : Index.get();}
+        llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
 };
 
 // CallExprAST - Expression class for function calls, allows us to do things like
-// 2 * multiply(4, 5) or x = add(3, 2)
+// 2 * multiply(4, 5) or x = add(3, 2). Also covers the vector builtins, which look
+// like calls: vec4(a, b, c, d), lane(v, i), insert(v, i, x), shuffle(v, 3, 2, 1, 0),
+// hadd(v), hmul(v), hmin(v) and hmax(v), plus len(a) for bufs
 class CallExprAST : public ExprAST {
     string Callee;
     vector<unique_ptr<ExprAST>> Args;
 
     public:
         CallExprAST(const string &Callee, vector<unique_ptr<ExprAST>> Args) :
-        Callee(Callee), Args(move(Args)) {}
-        void pretty_print(string end) override { 
-            printf("%s(", Callee.c_str());
-            int len = Args.size();
-            for (auto & element : Args) {
-                if (element != Args[len - 1]) {
-                    element->pretty_print(", ");
-                } else {
-                    element->pretty_print("");
-                }
-            }
-            printf(")%s", end.c_str());
+        ExprAST(expr_call), Callee(Callee), Args(move(Args)) {}
+        const string &getCallee() const {return Callee;}
+        size_t numKids() const override {return Args.size();}
+        const ExprAST *kid(size_t i) const override {return Args[i].get();}
+        llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
+};
+
+// IfExprAST - if/then/else. Both branches are expressions, so the whole thing
+// has a value, e.g. gate abs(x) if x < 0 then 0 - x else x
+class IfExprAST : public ExprAST {
+    unique_ptr<ExprAST> Cond, Then, Else;
+
+    public:
+        IfExprAST(unique_ptr<ExprAST> Cond, unique_ptr<ExprAST> Then, unique_ptr<ExprAST> Else) :
+        ExprAST(expr_if), Cond(move(Cond)), Then(move(Then)), Else(move(Else)) {}
+        size_t numKids() const override {return 3;}
+        const ExprAST *kid(size_t i) const override {
+            return i == 0 ? Cond.get() : i == 1 ? Then.get() : Else.get();
+        }
+        llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
+};
+
+// ForExprAST - counted loop, for i = start, end, step in body. i takes the values
+// start, start + step, ... while it hasn't passed end (step defaults to 1). The
+// loop evaluates to the sum of body over all iterations (0 if it never runs),
+// which is how we express reductions without recursion.
+class ForExprAST : public ExprAST {
+    string VarName;
+    unique_ptr<ExprAST> Start, End, Step, Body;
+
+    public:
+        ForExprAST(const string &VarName, unique_ptr<ExprAST> Start, unique_ptr<ExprAST> End,
+        unique_ptr<ExprAST> Step, unique_ptr<ExprAST> Body) :
+        ExprAST(expr_for), VarName(VarName), Start(move(Start)), End(move(End)), Step(move(Step)),
+        Body(move(Body)) {}
+        const string &getVarName() const {return VarName;}
+        size_t numKids() const override {return Step ? 4 : 3;}
+        const ExprAST *kid(size_t i) const override {
+            if (i == 0) return Start.get();
+            if (i == 1) return End.get();
+            return i == numKids() - 1 ? Body.get() : Step.get();
         }
         llvm::Value *codegen() override;
+        uint32_t serialize(ASTWriter &W) const override;
 };
 
 
 /* 2. Interface with functions, or prototypes 
 
 proto = func(args) 
+proto = func(args) : type
 
 */
 
 // PrototypeAST - Represents prototype of a function, including name, arg names
-// and thus arg number
+// and thus arg number. Args without a type, and the return value without one, are doubles
 class PrototypeAST {
     string Name;
     vector<string> Args;
+    vector<QType> ArgTypes;
+    QType RetType;
+    int Line = 0; // Of the gate's name
 
     public:
-        PrototypeAST(const string &name, vector<string> Args) :
-        Name(name), Args(move(Args)) {}
+        PrototypeAST(const string &name, vector<string> Args, vector<QType> ArgTypes = {},
+        QType RetType = ty_double) :
+        Name(name), Args(move(Args)), ArgTypes(move(ArgTypes)), RetType(RetType) {
+            this->ArgTypes.resize(this->Args.size(), ty_double);
+        }
     
         const string &getName() const {return Name;} // First non-constructor method!
-        void pretty_print(string end) { 
-            printf("Prototype: [%s(", Name.c_str());
-            int len = Args.size();
-            for (auto & element : Args) {
-                printf("%s", element.c_str());
-                if (element != Args[len - 1]) {
-                    printf(", ");
-                }
-            }
-            printf(")]%s", end.c_str());
-        }
+        QType getRetType() const {return RetType;}
+        const vector<QType> &getArgTypes() const {return ArgTypes;}
+        const vector<string> &getArgs() const {return Args;}
+        int getLine() const {return Line;}
+        void setLine(int L) {Line = L;}
         llvm::Function *codegen();
+        uint32_t serialize(ASTWriter &W) const;
 };
 
 
@@ -154,12 +282,9 @@ class FunctionAST {
     public:
         FunctionAST(unique_ptr<PrototypeAST> Proto, unique_ptr<ExprAST> Body) :
         Proto(move(Proto)), Body(move(Body)) {}
-        void pretty_print(string end) { 
-            printf("Function:\n  "); 
-            Proto->pretty_print("\n  "); 
-            printf("Body: ["); 
-            Body->pretty_print("]\n"); 
-            printf("%s", end.c_str());
-        }
+        const string &getName() const {return Proto->getName();}
+        const PrototypeAST &getProto() const {return *Proto;}
+        const ExprAST &getBody() const {return *Body;}
         llvm::Function *codegen();
+        uint32_t serialize(ASTWriter &W) const; // Just the body, the proto is separate
 };
\ No newline at end of file
@@ -4,80 +4,476 @@ Adin Gitig
 Sources: https://llvm.org/docs/tutorial/MyFirstLanguageFrontend/LangImpl01.html
 */
 
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/ADT/APFloat.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/Host.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include <algorithm>
 #include <iostream>
 #include <unistd.h>
+#include <getopt.h>
 #include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <cmath>
+#include <ctime>
 #include <utility>
 #include <cctype>
 #include <cstdio>
+#include <cstdarg>
 #include <memory>
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 
 
 #include "lexer.h"
 #include "ASTs.h"
+#include "timing.h"
 #include "parsers.h"
+#include "astfile.h"
+#include "astdump.h"
+#include "library.h"
+#include "server.h"
+#include "QadinJIT.h"
+#include "archive.h"
+#include "pipeline.h"
 
 using namespace llvm;
 
 
-static void HandleDefn(bool v) {
-    if (auto AST = ParseDefn()) {
-        fprintf(stderr, "Parsed a function definition.\n");
-        if (v) {
-            AST->pretty_print("\n");
+// Codegen state is per thread, so that the compile server (--serve) can have each
+// worker compiling a session of its own. Everywhere else, it's all on one thread
+static thread_local std::unique_ptr<LLVMContext> TheContext; // Useful for APIs apparently
+static thread_local std::unique_ptr<IRBuilder<>> Builder; // Makes it easy to gen LLVM instructions
+static thread_local std::unique_ptr<Module> TheModule; // Contains funcs, global vars
+// Tells the optimizer about vector widths etc. Caches subtargets, so isn't shareable
+static thread_local std::unique_ptr<TargetMachine> TheTargetMachine;
+static unsigned OptLevel = 0; // -O<n>, 0 leaves the IR as generated
+static std::string MArch = "generic"; // -march, the CPU to compile for without the JIT
+// What the driver writes out, --emit (-c and -shared are obj and shared)
+enum EmitMode {
+    emit_echo,      // Each item's IR to stderr as it's compiled, then the module at exit
+    emit_none,
+    emit_ll,        // Textual IR of the whole module, once at exit
+    emit_bc,        // Bitcode of the whole module, once at exit
+    emit_bc_stream, // Bitcode written as items are compiled, a module per StreamBatch items
+    emit_obj_stream, // Same, but an object per module, into a static library
+    emit_qlib,      // Bitcode per gate, into a library for import (library.h)
+    emit_obj,
+    emit_shared,
+};
+static EmitMode Emit = emit_echo;
+static std::unique_ptr<raw_fd_ostream> EmitOut; // -o, for ll, bc and bc-stream
+static std::unique_ptr<ArchiveWriter> EmitArchive; // -o, for obj-stream
+static std::unique_ptr<LibraryWriter> EmitLibrary; // -o, for qlib
+static unsigned StreamBatch = 64; // --stream-batch, items per module when streaming
+static unsigned StreamedModules = 0, ItemsInModule = 0;
+static std::unique_ptr<ASTWriter> SaveAST; // --save-ast, every item parsed goes in here
+static bool ParseOnly = false; // --parse-only, no codegen at all
+static std::unique_ptr<ASTDumper> Dumper; // -v and --dump-ast, every item parsed is written out
+// --export, whole-program mode: the program is complete when it's optimized, and only
+// these gates are called from outside it. See Internalize
+static bool WholeProgram = false;
+static std::set<std::string> Exports;
+// --fp-model. strict is IEEE as written, contract allows fused multiply-add, fast
+// allows anything fast-math does
+static const char *FPModel = "strict";
+// Which values are defined in curr scope, and what their LLVM rep is. 
+// In essence, symbol table
+static thread_local std::map<std::string, Value *> NamedValues;
+// Loop variables with integral start and step, mapped to the same value as an i64
+// computed from the loop's counter. See IntegerIndex
+static thread_local std::map<Value *, Value *> IntegerLoopVars;
+
+// What a module needs to know about a gate or extern defined in another one, to
+// declare and call it. Param names aren't kept, and the types are a char each, so
+// short signatures fit in the string without allocating
+struct Signature {
+    QType RetType = ty_double;
+    std::string ArgTypes;
+
+    Signature() = default;
+    Signature(QType RetType, StringRef ArgTypes) : RetType(RetType), ArgTypes(ArgTypes.str()) {}
+    Signature(const PrototypeAST &P) : RetType(P.getRetType()) {
+        for (QType Ty : P.getArgTypes()) {
+            ArgTypes += (char)Ty;
+        }
+    }
+
+    // Declares Name in TheModule, with unnamed params
+    Function *declare(const std::string &Name) const {
+        std::vector<QType> Types;
+        for (char C : ArgTypes) {
+            Types.push_back((QType)C);
+        }
+        return PrototypeAST(Name, std::vector<std::string>(Types.size()), Types, RetType).codegen();
+    }
+};
+// Every gate and extern seen so far, so that later modules can redeclare them (with
+// -j or --emit=*-stream each item ends up in a module of its own). This is all that
+// outlives an item
+static thread_local StringMap<Signature> Signatures;
+
+// Libraries the program imported, searched in that order. Every library opened stays
+// mapped until exit (OpenLibraries), so the server only ever opens one once
+static thread_local std::vector<const Library *> Imports;
+static std::map<std::string, std::unique_ptr<Library>> OpenLibraries;
+static std::mutex OpenLibrariesMutex;
+// Library gates the program has called so far. Linked once their body is in some module
+struct ImportedGate {
+    const Library *Lib;
+    const QLibEntry *Entry;
+    bool Linked = false;
+};
+static thread_local StringMap<ImportedGate> ImportedGates;
+
+// -g. Line tables only: every gate gets a subprogram and every expression a
+// location, which is what profilers need to map samples back to source lines
+static bool DebugInfo = false;
+static const char *SourceName = "<stdin>"; // The file debug info says it all came from
+static thread_local std::unique_ptr<DIBuilder> DBuilder; // Belong to TheModule, so remade with it
+static thread_local DICompileUnit *TheCU = nullptr;
+static thread_local DISubprogram *CurSubprogram = nullptr; // Of the gate being generated
+
+static std::unique_ptr<QadinJIT> TheJIT; // Only with -j or --serve
+static unsigned ServeWorkers = 0; // --serve-threads, 0 unless serving
+// Where this thread's gates go: the main JITDylib with -j, a session's with --serve,
+// nowhere when compiling ahead of time
+static thread_local orc::JITDylib *TheDylib = nullptr;
+static bool PerfJIT = false; // --perf, make JIT'd code visible to perf
+static ExitOnError ExitOnErr;
+// Host functions registered through QadinRegisterHost, by Qadin name
+static std::map<std::string, void *> HostSymbols;
+// With -j, the address of every extern we could find when it was declared. Calls to
+// these are emitted as calls to the address itself
+static thread_local std::map<std::string, void *> ExternAddrs;
+
+static void InitializeModule();
+static bool OptimizeModule(Module &M);
+
+
+// Compiles M to an object file in memory, for this thread's TheTargetMachine
+static void EmitObject(Module &M, SmallVectorImpl<char> &Buf) {
+    PhaseTimer T(ph_emit);
+    raw_svector_ostream OS(Buf);
+    legacy::PassManager PM;
+    if (TheTargetMachine->addPassesToEmitFile(PM, OS, nullptr, CGFT_ObjectFile)) {
+        LogError("The target can't emit object files");
+        exit(1);
+    }
+    PM.run(M);
+}
+
+
+// Shows what an item compiled to, when someone is watching (--emit=echo)
+static void EchoIR(Function *IR) {
+    if (Emit != emit_echo) return;
+    PhaseTimer T(ph_output);
+    IR->print(errs());
+    fprintf(stderr, "\n");
+}
+
+/* --emit=bc-stream and obj-stream. Once StreamBatch items are in the module (or
+Final, at the end of the input), writes it out and starts a fresh one, context and
+all, so neither IR nor ASTs pile up. Only Signatures grows, by one small entry per
+gate, so memory stays flat over any amount of input. Setting up the backend costs
+a couple of ms per module, which is why objects aren't made per item.
+
+For bc-stream every module goes out as a complete bitcode file, string table and
+all, minus the magic number after the first. LLVM reads that as one file of many
+modules, e.g. llvm-dis splits it into a .ll per module. For obj-stream each module
+is compiled to an object in memory, then goes into the archive. qlib is bc-stream
+with a module per gate, each going into the library under the gate's name */
+static void StreamModule(bool Final = false) {
+    if (Final ? ItemsInModule == 0 : ++ItemsInModule < StreamBatch) return;
+    ItemsInModule = 0;
+
+    OptimizeModule(*TheModule);
+    if (Emit == emit_bc_stream) {
+        PhaseTimer T(ph_output);
+        SmallVector<char, 0> Buf;
+        BitcodeWriter W(Buf);
+        W.writeModule(*TheModule);
+        W.writeStrtab();
+        size_t Skip = StreamedModules++ ? 4 : 0;
+        EmitOut->write(Buf.data() + Skip, Buf.size() - Skip);
+    } else if (Emit == emit_qlib) {
+        PhaseTimer T(ph_output);
+        SmallVector<char, 0> Buf;
+        raw_svector_ostream OS(Buf);
+        WriteBitcodeToFile(*TheModule, OS);
+        for (Function &F : *TheModule) {
+            if (!F.isDeclaration() && F.hasExternalLinkage()) { // Just the one gate
+                const Signature &Sig = Signatures[F.getName()];
+                EmitLibrary->add(F.getName(), Sig.RetType, Sig.ArgTypes, StringRef(Buf.data(), Buf.size()));
+            }
         }
-        if (auto *IR = AST->codegen()) {
-            IR->print(errs());
-            fprintf(stderr, "\n");
+        StreamedModules++;
+    } else {
+        SmallVector<char, 0> Buf;
+        EmitObject(*TheModule, Buf);
+
+        std::vector<std::string> Defined;
+        for (Function &F : *TheModule) {
+            if (!F.isDeclaration() && F.hasExternalLinkage()) {
+                Defined.push_back(F.getName().str());
+            }
+        }
+        EmitArchive->add(Buf.data(), Buf.size(), Defined);
+        StreamedModules++;
+    }
+    InitializeModule();
+}
+
+
+// Reports a JIT error like any other compile error, instead of exiting. With
+// --serve, whatever caused it came from a client
+static bool JITOk(Error E) {
+    if (!E) return true;
+    LogError(toString(std::move(E)).c_str());
+    return false;
+}
+
+
+/* Each kind of top level item is parsed by its Handle* function, which hands what it
+parsed to the Compile* one. The pipeline (PipelineLoop) runs the two halves on
+different threads */
+
+// What defining a gate called Name takes over, so that a definition that doesn't
+// compile, or that the JIT turns down (a gate an earlier module already defines),
+// can give it back rather than leave its own signature in place of the live one
+struct DefnBackup {
+    std::string Name;
+    bool HadSig, HadImport, HadExtern;
+    Signature Sig;
+    ImportedGate Import = {nullptr, nullptr};
+    void *Extern = nullptr;
+
+    DefnBackup(const std::string &Name) : Name(Name) {
+        auto SI = Signatures.find(Name);
+        if ((HadSig = SI != Signatures.end())) Sig = SI->second;
+        auto II = ImportedGates.find(Name);
+        if ((HadImport = II != ImportedGates.end())) Import = II->second;
+        auto EI = ExternAddrs.find(Name);
+        if ((HadExtern = EI != ExternAddrs.end())) Extern = EI->second;
+    }
+
+    void restore() {
+        Signatures.erase(Name);
+        if (HadSig) Signatures[Name] = Sig;
+        ImportedGates.erase(Name);
+        if (HadImport) ImportedGates[Name] = Import;
+        ExternAddrs.erase(Name);
+        if (HadExtern) ExternAddrs[Name] = Extern;
+    }
+};
+
+static void CompileDefn(std::unique_ptr<FunctionAST> AST) {
+    if (Emit == emit_echo) fprintf(stderr, "Parsed a function definition.\n");
+    if (Dumper) {
+        PhaseTimer T(ph_ast);
+        Dumper->gate(*AST);
+    }
+    if (SaveAST) SaveAST->addGate(*AST);
+    if (ParseOnly) return;
+    DefnBackup Old(AST->getName());
+    if (auto *IR = AST->codegen()) {
+        EchoIR(IR);
+        if (TheDylib) {
+            OptimizeModule(*TheModule);
+            if (!JITOk(TheJIT->addModule(orc::ThreadSafeModule(std::move(TheModule),
+            std::move(TheContext)), TheDylib->getDefaultResourceTracker()))) {
+                Old.restore();
+            }
+            InitializeModule();
+        } else if (Emit == emit_bc_stream || Emit == emit_obj_stream || Emit == emit_qlib) {
+            StreamModule();
         }
+    } else {
+        Old.restore();
+    }
+}
+
+static void HandleDefn() {
+    TraceSpan Item("gate");
+    if (auto AST = ParseDefn()) {
+        Item.rename("gate " + AST->getName());
+        CompileDefn(std::move(AST));
     } else {
         // Skip token for error recovery.
         getNextTok();
     }
 }
 
-static void HandleExtern(bool v) {
-    if (auto AST = ParseExtern()) {
-        fprintf(stderr, "Parsed an extern\n");
-        if (v) {
-            AST->pretty_print("\n");
-        }
-        if (auto *IR = AST->codegen()) {
-            IR->print(errs());
-            fprintf(stderr, "\n");
+// Finds the host function an extern refers to: registered ones first, then dlsym
+static void *ResolveExtern(const std::string &Name) {
+    auto It = HostSymbols.find(Name);
+    if (It != HostSymbols.end()) {
+        return It->second;
+    }
+    return sys::DynamicLibrary::SearchForAddressOfSymbol(Name);
+}
+
+static void CompileExtern(std::unique_ptr<PrototypeAST> AST) {
+    if (Emit == emit_echo) fprintf(stderr, "Parsed an extern\n");
+    if (Dumper) {
+        PhaseTimer T(ph_ast);
+        Dumper->externProto(*AST);
+    }
+    if (SaveAST) SaveAST->addExtern(*AST);
+    if (ParseOnly) return;
+    if (auto *IR = AST->codegen()) {
+        EchoIR(IR);
+        if (TheDylib) {
+            if (void *Addr = ResolveExtern(AST->getName())) {
+                ExternAddrs[AST->getName()] = Addr;
+            }
         }
+        Signatures[AST->getName()] = Signature(*AST);
+    }
+}
+
+static void HandleExtern() {
+    TraceSpan Item("extern");
+    if (auto AST = ParseExtern()) {
+        Item.rename("extern " + AST->getName());
+        CompileExtern(std::move(AST));
     } else {
         // Skip token for error recovery.
         getNextTok();
     }
 }
 
-static void HandleTopLevelExpr(bool v) {
+static void CompileTopLevelExpr(std::unique_ptr<FunctionAST> AST) {
+    if (Emit == emit_echo) fprintf(stderr, "Parsed a top-level expr\n");
+    if (Dumper) {
+        PhaseTimer T(ph_ast);
+        Dumper->expr(*AST);
+    }
+    if (SaveAST) SaveAST->addExpr(*AST);
+    if (ParseOnly) return;
+    if (Emit == emit_qlib) {
+        LogError("A library can only hold gates and externs, not top-level expressions");
+        return;
+    }
+    if (auto *IR = AST->codegen()) {
+        EchoIR(IR);
+        if (TheDylib) {
+            // The expression's module only lives until it has run
+            OptimizeModule(*TheModule);
+            auto RT = TheDylib->createResourceTracker();
+            bool Added = JITOk(TheJIT->addModule(orc::ThreadSafeModule(std::move(TheModule),
+            std::move(TheContext)), RT));
+            InitializeModule();
+            if (!Added) return;
+
+            auto ExprSymbol = [] {
+                PhaseTimer T(ph_emit);
+                return TheJIT->lookup(*TheDylib, "__anon_expr");
+            }();
+            if (JITOk(ExprSymbol.takeError())) {
+                double (*FP)() = (double (*)())(intptr_t)ExprSymbol->getAddress();
+                double Result;
+                {
+                    PhaseTimer T(ph_execute);
+                    Result = FP();
+                }
+                Report("Evaluated to %f\n", Result);
+            }
+
+            JITOk(RT->remove());
+        } else if (Emit == emit_bc_stream || Emit == emit_obj_stream) {
+            StreamModule();
+        }
+    }
+}
+
+static void HandleTopLevelExpr() {
     // Evaluate a top-level expression into an anonymous function.
+    TraceSpan Item("expression");
     if (auto AST = ParseTopLevelExpr()) {
-        fprintf(stderr, "Parsed a top-level expr\n");
-        if (v) {
-            AST->pretty_print("\n");
-        }
-        if (auto *IR = AST->codegen()) {
-            IR->print(errs());
-            fprintf(stderr, "\n");
-        }
+        CompileTopLevelExpr(std::move(AST));
+    } else {
+        // Skip token for error recovery.
+        getNextTok();
+    }
+}
+
+
+static void CompileImport(const std::string &Path) {
+    if (Emit == emit_echo) fprintf(stderr, "Parsed an import\n");
+    if (Dumper) {
+        PhaseTimer T(ph_ast);
+        Dumper->import(Path);
+    }
+    if (SaveAST) SaveAST->addImport(Path);
+    if (ParseOnly) return;
+    if (Emit == emit_qlib) {
+        LogError("A library can't import another");
+        return;
+    }
+    for (const Library *Lib : Imports) {
+        if (Lib->path() == Path) return;
+    }
+
+    std::lock_guard<std::mutex> Lock(OpenLibrariesMutex);
+    auto &Lib = OpenLibraries[Path];
+    if (!Lib) {
+        Lib = Library::open(Path);
+    }
+    if (Lib) {
+        Imports.push_back(Lib.get());
+    }
+}
+
+static void HandleImport() {
+    TraceSpan Item("import");
+    std::string Path;
+    if (ParseImport(Path)) {
+        Item.rename("import " + Path);
+        CompileImport(Path);
     } else {
         // Skip token for error recovery.
         getNextTok();
@@ -85,9 +481,9 @@ static void HandleTopLevelExpr(bool v) {
 }
 
 
-static void MainLoop(bool v) {
+static void MainLoop() {
     while (1) {
-        fprintf(stderr, "Qadin> ");
+        if (Emit == emit_echo) fprintf(stderr, "Qadin> ");
         switch(CurTok) {
             case tok_eof:
                 return;
@@ -95,16 +491,235 @@ static void MainLoop(bool v) {
                 getNextTok();
                 break;
             case tok_gate:
-                HandleDefn(v);
+                HandleDefn();
                 break;
             case tok_extern:
-                HandleExtern(v);
+                HandleExtern();
+                break;
+            case tok_import:
+                HandleImport();
                 break;
             default:
-                HandleTopLevelExpr(v);
+                HandleTopLevelExpr();
+                break;
+        }
+    }
+}
+
+
+
+/* --pipeline. Compiles the same items MainLoop would, but with the lexer and the
+parser each on a thread of their own, so reading input, parsing and codegen overlap.
+Codegen (and the JIT) stays on the calling thread. Tokens go from the lexer to the
+parser in batches of TokenBatchSize, parsed items go on to codegen one at a time.
+There is no prompt, the input isn't expected to be interactive */
+
+static const size_t TokenBatchSize = 256;
+static SPSCRing<TokenBatch, 64> TokenQueue;
+static SPSCRing<ParsedItem, 64> ItemQueue;
+static uint64_t LexedTokens = 0; // Only the lexer thread touches it until it's joined
+
+// Lexes In, which the calling thread was set to read from (the lexer's state is per
+// thread)
+static void LexStage(FILE *In) {
+    LexFrom(In);
+    TokenBatch Batch;
+    Batch.reserve(TokenBatchSize);
+    while (1) {
+        int Kind;
+        {
+            PhaseTimer T(ph_lex);
+            Kind = lexer();
+        }
+        bool HasId = Kind == tok_id || Kind == tok_type || Kind == tok_str;
+        Batch.push_back({Kind, CurLoc, NumVal, HasId ? IdStr : ""});
+        LexedTokens++;
+
+        if (Kind == tok_eof || Batch.size() == TokenBatchSize) {
+            TokenQueue.push(std::move(Batch));
+            if (Kind == tok_eof) return;
+            Batch = TokenBatch();
+            Batch.reserve(TokenBatchSize);
+        }
+    }
+}
+
+// The parser thread's TokenSource
+static thread_local TokenBatch QueuedTokens;
+static thread_local size_t QueuedPos = 0;
+
+static int QueuedToken() {
+    if (QueuedPos == QueuedTokens.size()) {
+        QueuedTokens = TokenQueue.pop();
+        QueuedPos = 0;
+    }
+    LexedToken &T = QueuedTokens[QueuedPos];
+    if (T.Kind != tok_eof) { // There's only one, but the parser may ask again
+        QueuedPos++;
+    }
+    CurLoc = T.Loc;
+    NumVal = T.Num;
+    IdStr.swap(T.Id);
+    return T.Kind;
+}
+
+// Parses the next top level item into Item, skipping ';'s and recovering from errors
+// as MainLoop does. Item.Kind is tok_eof at the end of the input
+static void ParseItem(ParsedItem &Item) {
+    while (1) {
+        switch (CurTok) {
+            case tok_eof:
+                Item.Kind = tok_eof;
+                return;
+            case ';':
+                getNextTok();
+                continue;
+            case tok_gate: {
+                TraceSpan Span("gate");
+                Item.Kind = tok_gate;
+                if ((Item.Fn = ParseDefn())) Span.rename("gate " + Item.Fn->getName());
+                break;
+            }
+            case tok_extern: {
+                TraceSpan Span("extern");
+                Item.Kind = tok_extern;
+                if ((Item.Proto = ParseExtern())) Span.rename("extern " + Item.Proto->getName());
+                break;
+            }
+            case tok_import: {
+                TraceSpan Span("import");
+                Item.Kind = tok_import;
+                if (ParseImport(Item.Path)) Span.rename("import " + Item.Path);
+                break;
+            }
+            default: {
+                TraceSpan Span("expression");
+                Item.Kind = 0;
+                Item.Fn = ParseTopLevelExpr();
                 break;
+            }
+        }
+
+        if (Item.Fn || Item.Proto || !Item.Path.empty()) {
+            return;
+        }
+        // Skip token for error recovery.
+        getNextTok();
+    }
+}
+
+static void ParseStage() {
+    TokenSource = QueuedToken;
+    getNextTok();
+    while (1) {
+        ParsedItem Item;
+        ParseItem(Item);
+        bool End = Item.Kind == tok_eof;
+        ItemQueue.push(std::move(Item));
+        if (End) return;
+    }
+}
+
+static void PrintRingStats(FILE *F, const char *Name, const RingStats &S, size_t Capacity) {
+    fprintf(F, "  %-8s %8zu %10llu %10.1f %8zu %14llu %14llu\n", Name, Capacity,
+    (unsigned long long)S.Pushes, S.Pushes ? (double)S.DepthSum / S.Pushes : 0.0, S.MaxDepth,
+    (unsigned long long)S.FullWaits, (unsigned long long)S.EmptyWaits);
+}
+
+static void PipelineLoop() {
+    TokenQueue.Stats = RingStats();
+    ItemQueue.Stats = RingStats();
+    LexedTokens = 0;
+    double Start = WallNow();
+    uint64_t Items = 0;
+
+    std::thread Lexer(LexStage, LexIn), Parser(ParseStage);
+    while (1) {
+        ParsedItem Item = ItemQueue.pop();
+        if (Item.Kind == tok_eof) break;
+        Items++;
+
+        if (Item.Kind == tok_gate) {
+            TraceSpan Span(("gate " + Item.Fn->getName()).c_str());
+            CompileDefn(std::move(Item.Fn));
+        } else if (Item.Kind == tok_extern) {
+            TraceSpan Span(("extern " + Item.Proto->getName()).c_str());
+            CompileExtern(std::move(Item.Proto));
+        } else if (Item.Kind == tok_import) {
+            TraceSpan Span(("import " + Item.Path).c_str());
+            CompileImport(Item.Path);
+        } else {
+            TraceSpan Span("expression");
+            CompileTopLevelExpr(std::move(Item.Fn));
+        }
+    }
+    Lexer.join();
+    Parser.join();
+
+    if (TimeReport) {
+        double Ms = (WallNow() - Start) / 1e6;
+        fprintf(stderr, "===-------------------------------------------------------------------------===\n");
+        fprintf(stderr, "                           Qadin pipeline\n");
+        fprintf(stderr, "===-------------------------------------------------------------------------===\n");
+        fprintf(stderr, "  %llu items, %llu tokens in %.3f ms: %.0f items/s, %.0f tokens/s\n",
+        (unsigned long long)Items, (unsigned long long)LexedTokens, Ms, Ms ? Items / Ms * 1e3 : 0,
+        Ms ? LexedTokens / Ms * 1e3 : 0);
+        fprintf(stderr, "  %-8s %8s %10s %10s %8s %14s %14s\n", "Queue", "Slots", "Pushes",
+        "Mean depth", "Max", "Producer waits", "Consumer waits");
+        PrintRingStats(stderr, "tokens", TokenQueue.Stats, TokenQueue.size());
+        PrintRingStats(stderr, "items", ItemQueue.Stats, ItemQueue.size());
+    }
+}
+
+// --load-ast. Compiles the items of a file --save-ast wrote, as MainLoop would have
+// after parsing them. Returns false if the file couldn't be read
+static bool LoadASTLoop(const char *Path) {
+    std::unique_ptr<ASTFile> File;
+    {
+        PhaseTimer T(ph_load);
+        File = ASTFile::open(Path);
+    }
+    if (!File) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < File->size(); i++) {
+        if (File->kind(i) == item_extern) {
+            TraceSpan Span("extern");
+            std::unique_ptr<PrototypeAST> AST;
+            {
+                PhaseTimer T(ph_load);
+                AST = File->externProto(i);
+            }
+            if (!AST) return false;
+            Span.rename("extern " + AST->getName());
+            CompileExtern(std::move(AST));
+        } else if (File->kind(i) == item_import) {
+            std::string Path = File->importPath(i);
+            if (Path.empty()) {
+                LogError("Bad AST file: broken import");
+                return false;
+            }
+            TraceSpan Span(("import " + Path).c_str());
+            CompileImport(Path);
+        } else {
+            bool Gate = File->kind(i) == item_gate;
+            TraceSpan Span(Gate ? "gate" : "expression");
+            std::unique_ptr<FunctionAST> AST;
+            {
+                PhaseTimer T(ph_load);
+                AST = File->function(i);
+            }
+            if (!AST) return false;
+            if (Gate) {
+                Span.rename("gate " + AST->getName());
+                CompileDefn(std::move(AST));
+            } else {
+                CompileTopLevelExpr(std::move(AST));
+            }
         }
     }
+    return true;
 }
 
 
@@ -115,26 +730,77 @@ Sources: https://llvm.org/docs/tutorial/MyFirstLanguageFrontend/LangImpl01.html
 */
 
 
-static std::unique_ptr<LLVMContext> TheContext; // Useful for APIs apparently
-static std::unique_ptr<IRBuilder<>> Builder; // Makes it easy to gen LLVM instructions
-static std::unique_ptr<Module> TheModule; // Contains funcs, global vars
-// Which values are defined in curr scope, and what their LLVM rep is. 
-// In essence, symbol table
-static std::map<std::string, Value *> NamedValues;
-
-
 Value *LogErrorV(const char *Str) {
     LogError(Str);
     return nullptr;
 }
 
 
+// Inside a gate a buf is carried around as one value, { double*, i64 }. It is only
+// split into pointer and length at the gate's boundary
+static StructType *BufType() {
+    return StructType::get(*TheContext, {Type::getDoublePtrTy(*TheContext), Type::getInt64Ty(*TheContext)});
+}
+
+// double, <N x double> for the vecN types, or the pair above for buf
+static Type *LLVMTypeFor(QType Ty) {
+    Type *DoubleTy = Type::getDoubleTy(*TheContext);
+    if (Ty == ty_double) {
+        return DoubleTy;
+    }
+    if (Ty == ty_buf) {
+        return BufType();
+    }
+    return FixedVectorType::get(DoubleTy, Ty);
+}
+
+
+// The signature of Name if it's a gate in one of the imported libraries, which is
+// then remembered so that LinkImports brings in its body
+static const Signature *FindImport(StringRef Name) {
+    for (const Library *Lib : Imports) {
+        if (const QLibEntry *E = Lib->find(Name)) {
+            ImportedGates[Name] = {Lib, E};
+            return &(Signatures[Name] = Signature((QType)E->RetType, Lib->argTypes(*E)));
+        }
+    }
+    return nullptr;
+}
+
+// The function in the current module, or a fresh declaration of it if an earlier
+// module defined it, or it's imported
+static Function *getFunction(const std::string &Name) {
+    if (auto *F = TheModule->getFunction(Name)) {
+        return F;
+    }
+
+    auto SI = Signatures.find(Name);
+    if (SI != Signatures.end()) {
+        return SI->second.declare(Name);
+    }
+    if (const Signature *Sig = FindImport(Name)) {
+        return Sig->declare(Name);
+    }
+    return nullptr;
+}
+
+
+// Attaches E's source location to the instructions generated from here on
+static void EmitLocation(ExprAST *E) {
+    if (!CurSubprogram) return;
+    Builder->SetCurrentDebugLocation(DILocation::get(*TheContext, E->getLoc().Line,
+    E->getLoc().Col, CurSubprogram));
+}
+
+
 Value *NumberExprAST::codegen() {
+    EmitLocation(this);
     return ConstantFP::get(*TheContext, APFloat(Val));
 }
 
 
 Value *VariableExprAST::codegen() {
+    EmitLocation(this);
     Value *V = NamedValues[IdName];
     if (!V) {
         LogErrorV("Unknown Variable Name");
@@ -144,10 +810,29 @@ Value *VariableExprAST::codegen() {
 
 
 Value *BinaryExprAST::codegen() {
+    EmitLocation(this);
     Value *L = left->codegen();
     Value *R = right->codegen();
 
     if (!L || !R) return nullptr;
+    EmitLocation(this); // The operands moved it on
+    if (L->getType() == BufType() || R->getType() == BufType()) {
+        return LogErrorV("A buf can only be indexed, e.g. a[i]");
+    }
+
+    // A scalar next to a vector is applied to every lane, e.g. 2 * v
+    if (L->getType() != R->getType()) {
+        auto *LVec = dyn_cast<FixedVectorType>(L->getType());
+        auto *RVec = dyn_cast<FixedVectorType>(R->getType());
+        if (LVec && RVec) {
+            return LogErrorV("Vector widths don't match");
+        }
+        if (LVec) {
+            R = Builder->CreateVectorSplat(LVec->getNumElements(), R, "splat");
+        } else {
+            L = Builder->CreateVectorSplat(RVec->getNumElements(), L, "splat");
+        }
+    }
 
     switch (Op) {
         case '+':
@@ -156,127 +841,1634 @@ Value *BinaryExprAST::codegen() {
             return Builder->CreateFSub(L, R, "subtmp");
         case '*':
             return Builder->CreateFMul(L, R, "multmp");
+        case '/':
+            return Builder->CreateFDiv(L, R, "divtmp");
         case '<':
+            // On vectors this compares lane by lane, giving 1.0 or 0.0 per lane
+            Type *ResultTy = L->getType();
             L = Builder->CreateFCmpULT(L, R, "cmptmp");
-            return Builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
-        default:
-            return LogErrorV("invalid BinOp");
+            return Builder->CreateUIToFP(L, ResultTy, "booltmp");
     }
+    return LogErrorV("invalid BinOp");
 }
 
 
-Value *CallExprAST::codegen() {
-    Function *CalleeF = TheModule->getFunction(Callee);
-    if (!CalleeF) {
-        return LogErrorV("Unknown function called");
-    }
+// If V is an integral, affine function of loop variables (i, i + 1, 2 * i - j, ...)
+// rebuild it in i64 from the loops' counters. Indexing through fptosi instead hides
+// the access pattern from SCEV, and the vectorizer then gives up on the loop.
+static Value *IntegerIndex(Value *V) {
+    Type *IdxTy = Type::getInt64Ty(*TheContext);
 
-    if (CalleeF->arg_size() != Args.size()) {
-        return LogErrorV("Incorrect number of arguments passed");
+    if (auto *C = dyn_cast<ConstantFP>(V)) {
+        double D = C->getValueAPF().convertToDouble();
+        if (D != (double)(int64_t)D) return nullptr;
+        return ConstantInt::get(IdxTy, (int64_t)D, true);
     }
 
-    std::vector<Value*> ArgsV;
-    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-        ArgsV.push_back(Args[i]->codegen());
-        if (!ArgsV.back()) {
-            return nullptr;
-        }
+    auto It = IntegerLoopVars.find(V);
+    if (It != IntegerLoopVars.end()) {
+        return It->second;
     }
 
-    return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+    auto *BO = dyn_cast<BinaryOperator>(V);
+    if (!BO) return nullptr;
+    Instruction::BinaryOps Op;
+    switch (BO->getOpcode()) {
+        case Instruction::FAdd: Op = Instruction::Add; break;
+        case Instruction::FSub: Op = Instruction::Sub; break;
+        case Instruction::FMul: Op = Instruction::Mul; break;
+        default: return nullptr;
+    }
+    Value *L = IntegerIndex(BO->getOperand(0));
+    Value *R = L ? IntegerIndex(BO->getOperand(1)) : nullptr;
+    if (!R) return nullptr;
+    auto *I = BinaryOperator::Create(Op, L, R, "intidx", BO);
+    I->setHasNoSignedWrap();
+    return I;
 }
 
 
-Function* PrototypeAST::codegen() {
-    std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*TheContext));
-
-    FunctionType *FT = FunctionType::get(Type::getDoubleTy(*TheContext),
-    Doubles, false);
-
-    Function *F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+// Address of a[i], shared by loads and stores
+static Value *BufElementPtr(const std::string &BufName, ExprAST &Index) {
+    Value *Buf = NamedValues[BufName];
+    if (!Buf) {
+        return LogErrorV("Unknown Variable Name");
+    }
+    if (Buf->getType() != BufType()) {
+        return LogErrorV("Only a buf can be indexed");
+    }
 
-    unsigned Idx = 0;
-    for (auto &Arg : F->args()) {
-        Arg.setName(Args[Idx++]);
+    Value *IdxV = Index.codegen();
+    if (!IdxV) return nullptr;
+    if (IdxV->getType()->isVectorTy()) {
+        return LogErrorV("Index must be a scalar");
     }
 
-    return F;
+    Value *Base = Builder->CreateExtractValue(Buf, 0, BufName + ".ptr");
+    if (Value *IntIdx = IntegerIndex(IdxV)) {
+        IdxV = IntIdx;
+    } else {
+        IdxV = Builder->CreateFPToSI(IdxV, Type::getInt64Ty(*TheContext), "idx");
+    }
+    return Builder->CreateInBoundsGEP(Type::getDoubleTy(*TheContext), Base, IdxV, "elemptr");
 }
 
 
-Function *FunctionAST::codegen() {
-    Function *TheFunction = TheModule->getFunction(Proto->getName());
+Value *IndexExprAST::codegen() {
+    EmitLocation(this);
+    Value *Ptr = BufElementPtr(BufName, *Index);
+    if (!Ptr) return nullptr;
+    return Builder->CreateAlignedLoad(Type::getDoubleTy(*TheContext), Ptr, Align(8), "elem");
+}
 
-    if (!TheFunction) {
-        TheFunction = Proto->codegen();
-    }
 
-    if (!TheFunction) {
-        return nullptr;
+Value *StoreExprAST::codegen() {
+    EmitLocation(this);
+    Value *V = Val->codegen();
+    if (!V) return nullptr;
+    if (V->getType() != Type::getDoubleTy(*TheContext)) {
+        return LogErrorV("Only scalars can be stored in a buf");
     }
 
-    if (!TheFunction->empty()) {
-        return (Function*)LogErrorV("Function can't be redefined.");
-    }
+    Value *Ptr = BufElementPtr(BufName, *Index);
+    if (!Ptr) return nullptr;
+    Builder->CreateAlignedStore(V, Ptr, Align(8));
+    return V;
+}
 
-    BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
-    Builder->SetInsertPoint(BB);
 
-    NamedValues.clear();
-    for (auto &Arg : TheFunction->args()) {
-        NamedValues[Arg.getName()] = &Arg;
+Value *IfExprAST::codegen() {
+    EmitLocation(this);
+    Value *CondV = Cond->codegen();
+    if (!CondV) return nullptr;
+    if (CondV->getType()->isVectorTy()) {
+        return LogErrorV("if condition must be a scalar");
     }
 
-    if (Value *RetVal = Body->codegen()) {
-        Builder->CreateRet(RetVal);
+    // Anything that isn't 0.0 is true
+    CondV = Builder->CreateFCmpONE(CondV, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
 
-        verifyFunction(*TheFunction);
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
+    BasicBlock *ElseBB = BasicBlock::Create(*TheContext, "else");
+    BasicBlock *MergeBB = BasicBlock::Create(*TheContext, "ifcont");
 
-        return TheFunction;
+    Builder->CreateCondBr(CondV, ThenBB, ElseBB);
+
+    Builder->SetInsertPoint(ThenBB);
+    Value *ThenV = Then->codegen();
+    if (!ThenV) return nullptr;
+    Builder->CreateBr(MergeBB);
+    ThenBB = Builder->GetInsertBlock(); // Then may have added blocks (nested if/for)
+
+    TheFunction->getBasicBlockList().push_back(ElseBB);
+    Builder->SetInsertPoint(ElseBB);
+    Value *ElseV = Else->codegen();
+    if (!ElseV) return nullptr;
+    Builder->CreateBr(MergeBB);
+    ElseBB = Builder->GetInsertBlock();
+
+    if (ThenV->getType() != ElseV->getType()) {
+        return LogErrorV("then and else have different types");
     }
 
-    TheFunction->eraseFromParent();
-    return nullptr;
+    TheFunction->getBasicBlockList().push_back(MergeBB);
+    Builder->SetInsertPoint(MergeBB);
+    PHINode *PN = Builder->CreatePHI(ThenV->getType(), 2, "iftmp");
+    PN->addIncoming(ThenV, ThenBB);
+    PN->addIncoming(ElseV, ElseBB);
+    return PN;
 }
 
 
-/* Initialize llvm fancy stuff that I hate */
-//===----------------------------------------------------------------------===//
-// Top-Level parsing and JIT Driver
-//===----------------------------------------------------------------------===//
+/* The loop is emitted in the shape LLVM's loop passes expect, so that the vectorizers
+can pick it up:
 
-static void InitializeModule() {
-    // Open a new context and module.
-    TheContext = std::make_unique<LLVMContext>();
-    TheModule = std::make_unique<Module>("my cool jit", *TheContext);
+  preheader: n = trip count, computed once; if n > 0 goto loop else goto afterloop
+  loop:      idx = phi [0, preheader], [idx + 1, loop]   <- the only induction variable
+             acc = phi [0, preheader], [acc + body, loop]
+             i = start + idx * step
+             ... body ...
+             if idx + 1 < n goto loop else goto afterloop
+  afterloop: phi [0, preheader], [acc + body, loop]
 
-    // Create a new builder for the module.
-    Builder = std::make_unique<IRBuilder<>>(*TheContext);
-}
+Counting with an integer and rebuilding i from it keeps the trip count computable,
+which a floating point induction variable would not. */
+Value *ForExprAST::codegen() {
+    EmitLocation(this);
+    Value *StartV = Start->codegen();
+    if (!StartV) return nullptr;
+    Value *EndV = End->codegen();
+    if (!EndV) return nullptr;
+    Value *StepV = Step ? Step->codegen() : ConstantFP::get(*TheContext, APFloat(1.0));
+    if (!StepV) return nullptr;
 
-int main(int argc, char** argv) {
+    Type *DoubleTy = Type::getDoubleTy(*TheContext);
+    if (StartV->getType() != DoubleTy || EndV->getType() != DoubleTy || StepV->getType() != DoubleTy) {
+        return LogErrorV("for bounds and step must be scalars");
+    }
+    Type *IdxTy = Type::getInt64Ty(*TheContext);
+
+    // n = ceil((end - start) / step). The saturating conversion sends NaN to 0 and
+    // out of range values to the i64 limits, rather than to poison.
+    Value *Span = Builder->CreateFDiv(Builder->CreateFSub(EndV, StartV, "span"), StepV, "steps");
+    Span = Builder->CreateUnaryIntrinsic(Intrinsic::ceil, Span);
+    Value *TripCount = Builder->CreateIntrinsic(Intrinsic::fptosi_sat, {IdxTy, DoubleTy}, {Span},
+    nullptr, "tripcount");
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+    BasicBlock *LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
+    BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "afterloop");
+
+    Value *Guard = Builder->CreateICmpSGT(TripCount, ConstantInt::get(IdxTy, 0), "guard");
+    Builder->CreateCondBr(Guard, LoopBB, AfterBB);
 
-    bool verbose = false;
+    Builder->SetInsertPoint(LoopBB);
+    PHINode *Idx = Builder->CreatePHI(IdxTy, 2, "idx");
+    Idx->addIncoming(ConstantInt::get(IdxTy, 0), PreheaderBB);
 
-    switch(getopt(argc, argv, "v")) {
-        case 'v':
-            verbose = true;
+    Value *Var = Builder->CreateFAdd(StartV,
+    Builder->CreateFMul(Builder->CreateSIToFP(Idx, DoubleTy), StepV), VarName);
+
+    // So that a[i] indexes with start + idx * step in i64 (left for DCE if unused)
+    Value *IntStart = IntegerIndex(StartV), *IntStep = IntegerIndex(StepV);
+    if (IntStart && IntStep) {
+        IntegerLoopVars[Var] = Builder->CreateNSWAdd(IntStart,
+        Builder->CreateNSWMul(Idx, IntStep), VarName + ".int");
     }
 
-    install_binops();
+    // The loop variable shadows anything of the same name for the body only
+    Value *OldVal = NamedValues[VarName];
+    NamedValues[VarName] = Var;
 
-    // Prime the first token.
-    fprintf(stderr, "Qadin> ");
-    getNextTok();
+    Value *BodyV = Body->codegen();
+    IntegerLoopVars.erase(Var);
 
-    // Make the module, which holds all the code.
-    InitializeModule();
+    if (OldVal) {
+        NamedValues[VarName] = OldVal;
+    } else {
+        NamedValues.erase(VarName);
+    }
+    if (!BodyV) return nullptr;
 
-    // Run the main "interpreter loop" now.
-    MainLoop(verbose);
+    // The accumulator's type is the body's, so it is only known now
+    Constant *Zero = Constant::getNullValue(BodyV->getType());
+    PHINode *Acc = PHINode::Create(BodyV->getType(), 2, "acc", LoopBB->getFirstNonPHI());
+    Acc->addIncoming(Zero, PreheaderBB);
 
-    // Print out all of the generated code.
-    TheModule->print(errs(), nullptr);
+    // reassoc lets the vectorizer keep one partial sum per lane
+    Value *NextAcc = Builder->CreateFAdd(Acc, BodyV, "nextacc");
+    FastMathFlags FMF;
+    FMF.setAllowReassoc();
+    cast<Instruction>(NextAcc)->setFastMathFlags(FMF);
 
-    return 0;
-}
\ No newline at end of file
+    Value *NextIdx = Builder->CreateAdd(Idx, ConstantInt::get(IdxTy, 1), "nextidx", true, true);
+    Value *LoopCond = Builder->CreateICmpSLT(NextIdx, TripCount, "loopcond");
+
+    BasicBlock *LoopEndBB = Builder->GetInsertBlock(); // Body may have added blocks
+    Builder->CreateCondBr(LoopCond, LoopBB, AfterBB);
+    Idx->addIncoming(NextIdx, LoopEndBB);
+    Acc->addIncoming(NextAcc, LoopEndBB);
+
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+    PHINode *Sum = Builder->CreatePHI(BodyV->getType(), 2, "forsum");
+    Sum->addIncoming(Zero, PreheaderBB);
+    Sum->addIncoming(NextAcc, LoopEndBB);
+    return Sum;
+}
+
+
+/* Vector builtins. They look like calls but are lowered straight to LLVM vector
+instructions:
+  vecN(x)            every lane set to x
+  vecN(a, b, ...)    one scalar per lane
+  lane(v, i)         extract lane i
+  insert(v, i, x)    v with lane i replaced by x
+  shuffle(v, i...)   a new vector of the listed lanes of v (2, 4 or 8 of them, constants)
+  shuffle(v, w, i...) same, but lanes of w follow on from those of v
+  hadd/hmul/hmin/hmax(v)  horizontal reductions down to a scalar
+and len(a), the number of elements in a buf.
+*/
+static bool IsBuiltin(const std::string &Name) {
+    static const char *Names[] = {"vec2", "vec4", "vec8", "lane", "insert", "shuffle",
+    "hadd", "hmul", "hmin", "hmax", "len"};
+    for (const char *B : Names) {
+        if (Name == B) return true;
+    }
+    return false;
+}
+
+static Value *CodegenBuiltin(const std::string &Callee, std::vector<Value*> &ArgsV) {
+    Type *DoubleTy = Type::getDoubleTy(*TheContext);
+    unsigned N = ArgsV.size();
+
+    if (Callee == "len") {
+        if (N != 1 || ArgsV[0]->getType() != BufType()) {
+            return LogErrorV("len expects a single buf");
+        }
+        return Builder->CreateUIToFP(Builder->CreateExtractValue(ArgsV[0], 1), DoubleTy, "len");
+    }
+
+    QType Ty = TypeFromName(Callee);
+    if (Ty != ty_double) {
+        for (Value *A : ArgsV) {
+            if (A->getType() != DoubleTy) {
+                return LogErrorV("Vector lanes must be scalars");
+            }
+        }
+        if (N == 1) {
+            return Builder->CreateVectorSplat(Ty, ArgsV[0], "splat");
+        }
+        if (N != (unsigned)Ty) {
+            return LogErrorV("Wrong number of lanes passed to vector constructor");
+        }
+        Value *V = PoisonValue::get(FixedVectorType::get(DoubleTy, Ty));
+        for (unsigned i = 0; i < N; i++) {
+            V = Builder->CreateInsertElement(V, ArgsV[i], i, "vecinit");
+        }
+        return V;
+    }
+
+    auto *VecTy = N ? dyn_cast<FixedVectorType>(ArgsV[0]->getType()) : nullptr;
+    if (!VecTy) {
+        return LogErrorV("Vector builtin expects a vector as its first argument");
+    }
+
+    if (Callee == "lane" || Callee == "insert") {
+        if (N != (Callee == "lane" ? 2u : 3u)) {
+            return LogErrorV("Incorrect number of arguments passed");
+        }
+        if (ArgsV[1]->getType() != DoubleTy || (N == 3 && ArgsV[2]->getType() != DoubleTy)) {
+            return LogErrorV("Lane index and value must be scalars");
+        }
+        Value *Idx = Builder->CreateFPToUI(ArgsV[1], Type::getInt32Ty(*TheContext), "laneidx");
+        if (N == 2) {
+            return Builder->CreateExtractElement(ArgsV[0], Idx, "lane");
+        }
+        return Builder->CreateInsertElement(ArgsV[0], ArgsV[2], Idx, "insert");
+    }
+
+    if (Callee == "shuffle") {
+        Value *Second = PoisonValue::get(VecTy);
+        unsigned First = 1, Avail = VecTy->getNumElements();
+        if (N > 1 && ArgsV[1]->getType()->isVectorTy()) {
+            if (ArgsV[1]->getType() != VecTy) {
+                return LogErrorV("Vector widths don't match");
+            }
+            Second = ArgsV[1];
+            First = 2;
+            Avail *= 2;
+        }
+
+        SmallVector<int, 8> Mask;
+        for (unsigned i = First; i < N; i++) {
+            auto *C = dyn_cast<ConstantFP>(ArgsV[i]);
+            if (!C) {
+                return LogErrorV("shuffle lanes must be constants");
+            }
+            double Lane = C->getValueAPF().convertToDouble();
+            if (Lane < 0 || Lane >= Avail || Lane != (int)Lane) {
+                return LogErrorV("shuffle lane out of range");
+            }
+            Mask.push_back((int)Lane);
+        }
+        if (Mask.size() != 2 && Mask.size() != 4 && Mask.size() != 8) {
+            return LogErrorV("shuffle must pick 2, 4 or 8 lanes");
+        }
+        return Builder->CreateShuffleVector(ArgsV[0], Second, Mask, "shuffle");
+    }
+
+    if (N != 1) {
+        return LogErrorV("Incorrect number of arguments passed");
+    }
+
+    // Reductions may be evaluated as a tree rather than lane by lane in order
+    Value *R;
+    if (Callee == "hadd") {
+        R = Builder->CreateFAddReduce(ConstantFP::get(DoubleTy, -0.0), ArgsV[0]);
+    } else if (Callee == "hmul") {
+        R = Builder->CreateFMulReduce(ConstantFP::get(DoubleTy, 1.0), ArgsV[0]);
+    } else if (Callee == "hmin") {
+        R = Builder->CreateFPMinReduce(ArgsV[0]);
+    } else {
+        R = Builder->CreateFPMaxReduce(ArgsV[0]);
+    }
+    FastMathFlags FMF;
+    FMF.setAllowReassoc();
+    cast<Instruction>(R)->setFastMathFlags(FMF);
+    return R;
+}
+
+
+Value *CallExprAST::codegen() {
+    EmitLocation(this);
+    if (IsBuiltin(Callee)) {
+        std::vector<Value*> ArgsV;
+        for (auto &Arg : Args) {
+            ArgsV.push_back(Arg->codegen());
+            if (!ArgsV.back()) {
+                return nullptr;
+            }
+        }
+        return CodegenBuiltin(Callee, ArgsV);
+    }
+
+    Function *CalleeF = getFunction(Callee);
+    if (!CalleeF) {
+        return LogErrorV("Unknown function called");
+    }
+
+    // A buf argument fills two LLVM parameters, so walk them separately (P)
+    std::vector<Value*> ArgsV;
+    unsigned P = 0;
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+        if (P >= CalleeF->arg_size()) {
+            return LogErrorV("Incorrect number of arguments passed");
+        }
+
+        Value *V = Args[i]->codegen();
+        if (!V) {
+            return nullptr;
+        }
+
+        Type *ParamTy = CalleeF->getArg(P)->getType();
+        if (ParamTy->isPointerTy()) {
+            if (V->getType() != BufType()) {
+                return LogErrorV("Argument type doesn't match the prototype");
+            }
+            ArgsV.push_back(Builder->CreateExtractValue(V, 0));
+            ArgsV.push_back(Builder->CreateExtractValue(V, 1));
+            P += 2;
+        } else {
+            if (V->getType() != ParamTy) {
+                return LogErrorV("Argument type doesn't match the prototype");
+            }
+            ArgsV.push_back(V);
+            P++;
+        }
+    }
+
+    if (P != CalleeF->arg_size()) {
+        return LogErrorV("Incorrect number of arguments passed");
+    }
+
+    EmitLocation(this); // Back from the arguments
+
+    // A host function we already have the address of is called there directly,
+    // rather than through a symbol the JIT would route via a stub
+    auto Host = ExternAddrs.find(Callee);
+    if (Host != ExternAddrs.end()) {
+        FunctionType *FT = CalleeF->getFunctionType();
+        Value *Addr = ConstantExpr::getIntToPtr(
+        ConstantInt::get(Type::getInt64Ty(*TheContext), (uint64_t)(uintptr_t)Host->second),
+        FT->getPointerTo());
+        return Builder->CreateCall(FT, Addr, ArgsV, "calltmp");
+    }
+
+    return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+}
+
+
+Function* PrototypeAST::codegen() {
+    PhaseTimer T(ph_irgen);
+    if (IsBuiltin(Name)) { // Calls would never reach it
+        return (Function*)LogErrorV("Can't define a builtin as a gate or extern");
+    }
+    std::vector<Type*> ArgTys;
+    for (QType Ty : ArgTypes) {
+        if (Ty == ty_buf) { // Pointer, then length
+            ArgTys.push_back(Type::getDoublePtrTy(*TheContext));
+            ArgTys.push_back(Type::getInt64Ty(*TheContext));
+        } else {
+            ArgTys.push_back(LLVMTypeFor(Ty));
+        }
+    }
+
+    FunctionType *FT = FunctionType::get(LLVMTypeFor(RetType), ArgTys, false);
+
+    Function *F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+
+    unsigned Idx = 0;
+    for (unsigned i = 0; i < Args.size(); i++) {
+        F->getArg(Idx++)->setName(Args[i]);
+        if (ArgTypes[i] == ty_buf) {
+            // The host owns the memory and nothing else can reach it through this
+            // call, which is what lets loops over it vectorize without runtime checks
+            F->addParamAttr(Idx - 1, Attribute::NoAlias);
+            F->addParamAttr(Idx - 1, Attribute::NoCapture);
+            F->addParamAttr(Idx - 1, Attribute::getWithAlignment(*TheContext, Align(8)));
+            F->getArg(Idx++)->setName(Args[i] + ".len");
+        }
+    }
+
+    return F;
+}
+
+
+Function *FunctionAST::codegen() {
+    PhaseTimer T(ph_irgen);
+    if (IsBuiltin(Proto->getName())) {
+        return (Function*)LogErrorV("Can't define a builtin as a gate or extern");
+    }
+    // A gate takes over its name from any extern declared before it, or library gate
+    // not yet linked in
+    auto Imported = ImportedGates.find(Proto->getName());
+    if (Imported != ImportedGates.end()) {
+        if (Imported->second.Linked) {
+            return (Function*)LogErrorV("Gate already imported from a library.");
+        }
+        ImportedGates.erase(Imported);
+    }
+    ExternAddrs.erase(Proto->getName());
+    Signatures[Proto->getName()] = Signature(*Proto);
+    Function *TheFunction = TheModule->getFunction(Proto->getName());
+    if (!TheFunction) {
+        TheFunction = Proto->codegen();
+    }
+
+    if (!TheFunction) {
+        return nullptr;
+    }
+
+    if (!TheFunction->empty()) {
+        return (Function*)LogErrorV("Function can't be redefined.");
+    }
+
+    BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
+    Builder->SetInsertPoint(BB);
+
+    CurSubprogram = nullptr;
+    Builder->SetCurrentDebugLocation(DebugLoc());
+    if (DBuilder) {
+        DIFile *Unit = TheCU->getFile();
+        int Line = Proto->getLine();
+        CurSubprogram = DBuilder->createFunction(Unit, Proto->getName(), StringRef(), Unit, Line,
+        DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(None)), Line,
+        DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
+        TheFunction->setSubprogram(CurSubprogram);
+    }
+
+    NamedValues.clear();
+    for (auto AI = TheFunction->arg_begin(), AE = TheFunction->arg_end(); AI != AE; ++AI) {
+        std::string ArgName(AI->getName());
+        if (AI->getType()->isPointerTy()) { // Put a buf's pointer and length back together
+            Value *Buf = Builder->CreateInsertValue(UndefValue::get(BufType()), &*AI, 0);
+            ++AI;
+            NamedValues[ArgName] = Builder->CreateInsertValue(Buf, &*AI, 1, ArgName);
+        } else {
+            NamedValues[ArgName] = &*AI;
+        }
+    }
+
+    Value *RetVal = Body->codegen();
+    if (RetVal && RetVal->getType() != TheFunction->getReturnType()) {
+        RetVal = LogErrorV("Body type doesn't match the return type in the prototype");
+    }
+
+    if (RetVal) {
+        Builder->CreateRet(RetVal);
+        if (CurSubprogram) {
+            DBuilder->finalizeSubprogram(CurSubprogram);
+        }
+
+        PhaseTimer V(ph_verify);
+        verifyFunction(*TheFunction);
+
+        return TheFunction;
+    }
+
+    TheFunction->eraseFromParent();
+    if (CurSubprogram) {
+        DBuilder->finalizeSubprogram(CurSubprogram);
+    }
+    return nullptr;
+}
+
+
+/* Initialize llvm fancy stuff that I hate */
+//===----------------------------------------------------------------------===//
+// Top-Level parsing and JIT Driver
+//===----------------------------------------------------------------------===//
+
+// CPU is a name LLVM knows (e.g. skylake), generic, or native for the CPU we're running
+// on, which is what JIT'd code runs on too
+static std::unique_ptr<TargetMachine> CreateTargetMachine(const std::string &CPUName) {
+    std::string TargetTriple = sys::getDefaultTargetTriple();
+    std::string Error;
+    auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (!Target) {
+        errs() << Error << "\n";
+        exit(1);
+    }
+
+    std::string CPU = CPUName;
+    SubtargetFeatures Features;
+    if (CPU == "native") {
+        CPU = sys::getHostCPUName().str();
+        StringMap<bool> HostFeatures;
+        if (sys::getHostCPUFeatures(HostFeatures)) {
+            for (auto &F : HostFeatures) {
+                Features.AddFeature(F.first(), F.second);
+            }
+        }
+    }
+
+    // PIC so that -shared objects can use it too
+    return std::unique_ptr<TargetMachine>(Target->createTargetMachine(TargetTriple, CPU,
+    Features.getString(), TargetOptions(), Reloc::PIC_));
+}
+
+static void InitializeTargetMachine(const std::string &CPU) {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    TheTargetMachine = CreateTargetMachine(CPU);
+}
+
+static void InitializeModule() {
+    // Anything left of the old module belongs to the old context, so goes first
+    DBuilder.reset();
+    CurSubprogram = nullptr;
+    Builder.reset();
+    TheModule.reset();
+
+    // Open a new context and module.
+    TheContext = std::make_unique<LLVMContext>();
+    TheModule = std::make_unique<Module>("my cool jit", *TheContext);
+    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+    TheModule->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+
+    // Create a new builder for the module.
+    Builder = std::make_unique<IRBuilder<>>(*TheContext);
+
+    FastMathFlags FMF;
+    if (!strcmp(FPModel, "fast")) {
+        FMF.setFast();
+    } else if (!strcmp(FPModel, "contract")) {
+        FMF.setAllowContract();
+    }
+    Builder->setFastMathFlags(FMF);
+
+    if (DebugInfo) {
+        TheModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+        TheModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+        DBuilder = std::make_unique<DIBuilder>(*TheModule);
+        TheCU = DBuilder->createCompileUnit(dwarf::DW_LANG_C, DBuilder->createFile(SourceName, "."),
+        "Qadin", OptLevel > 0, "", 0, StringRef(), DICompileUnit::LineTablesOnly);
+    }
+}
+
+/* Brings in the body of every imported gate M calls, and of everything those call in
+turn, as bitcode straight from the library's mapping. Each goes in once, into the
+first module that needs it: linked into M itself, where the optimizer can inline it,
+or with -j added to the JIT as a module of its own, since M may be an expression's
+and get thrown away once it has run */
+static void LinkImports(Module &M) {
+    if (ImportedGates.empty()) return;
+    PhaseTimer T(ph_link);
+
+    std::vector<StringRef> Work;
+    auto Want = [&](Module &From) {
+        for (Function &F : From) {
+            if (!F.isDeclaration() || F.isIntrinsic()) continue;
+            auto It = ImportedGates.find(F.getName());
+            if (It == ImportedGates.end() && !Signatures.count(F.getName()) && FindImport(F.getName())) {
+                It = ImportedGates.find(F.getName());
+            }
+            if (It != ImportedGates.end() && !It->second.Linked) {
+                It->second.Linked = true;
+                Work.push_back(It->first()); // The map owns the key, so it outlives F
+            }
+        }
+    };
+    Want(M);
+
+    while (!Work.empty()) {
+        StringRef Name = Work.back();
+        Work.pop_back();
+        const ImportedGate &G = ImportedGates[Name];
+
+        std::unique_ptr<LLVMContext> Ctx;
+        if (TheDylib) Ctx = std::make_unique<LLVMContext>();
+        auto Lib = parseBitcodeFile(MemoryBufferRef(G.Lib->bitcode(*G.Entry), Name),
+        TheDylib ? *Ctx : M.getContext());
+        if (!Lib) {
+            LogError((G.Lib->path() + ": can't read gate " + Name.str() + ": " +
+            toString(Lib.takeError())).c_str());
+            continue;
+        }
+        (*Lib)->setDataLayout(TheTargetMachine->createDataLayout());
+        (*Lib)->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+        Want(**Lib);
+
+        if (TheDylib) {
+            JITOk(TheJIT->addModule(orc::ThreadSafeModule(std::move(*Lib), std::move(Ctx)),
+            TheDylib->getDefaultResourceTracker()));
+        } else if (Linker::linkModules(M, std::move(*Lib))) {
+            LogError((G.Lib->path() + ": can't link gate " + Name.str()).c_str());
+        }
+    }
+}
+
+/* Whole-program mode. Every gate is codegen'd with external linkage, since until the
+input ends any of them might be called by something not yet seen, or by the host.
+Once the whole program is in M, all but the exported gates are made internal. LLVM
+can then delete the ones nothing calls (GlobalDCE), along with the __anon_expr a
+top-level expression left behind, and inline the rest freely: a gate inlined
+everywhere it's called no longer has to be kept for callers outside.
+
+Gate libraries are mostly tiny arithmetic helpers, called from a few hot roots. A
+call to one costs about as much as its body, so the inliner gets a higher threshold
+than -O2's 225: WholeProgramInlineThreshold unless --inline-threshold says otherwise.
+Helpers with a single caller are inlined whatever their size anyway, once internal.
+LLVM 14's PassBuilder only takes the threshold from its own command line, so main
+passes it on there */
+static const int WholeProgramInlineThreshold = 1000;
+
+// False, leaving M alone, if an export isn't one of its gates: internalizing
+// everything would leave nothing to export
+static bool Internalize(Module &M) {
+    bool Ok = true;
+    for (const std::string &Name : Exports) {
+        Function *F = M.getFunction(Name);
+        if (!F || F->isDeclaration()) {
+            fprintf(stderr, "--export: no gate called %s\n", Name.c_str());
+            Ok = false;
+        }
+    }
+    if (!Ok) return false;
+    internalizeModule(M, [](const GlobalValue &GV) {
+        return Exports.count(GV.getName().str()) > 0;
+    });
+    return true;
+}
+
+// Runs the standard -O<n> pipeline, which includes the loop and SLP vectorizers. The
+// module is complete by the time it's optimized, so imported gates are linked in and
+// its debug info is finished here too, and in whole-program mode it's internalized.
+// False if that fails, in which case it isn't optimized either
+static bool OptimizeModule(Module &M) {
+    if (&M == TheModule.get()) {
+        if (Emit != emit_qlib) LinkImports(M);
+        if (DBuilder) DBuilder->finalize();
+        if (WholeProgram && !Internalize(M)) return false;
+    }
+    if (OptLevel == 0 && !WholeProgram) return true;
+    PhaseTimer T(ph_optimize);
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB(TheTargetMachine.get());
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    OptimizationLevel Levels[] = {OptimizationLevel::O0, OptimizationLevel::O1,
+    OptimizationLevel::O2, OptimizationLevel::O3};
+    ModulePassManager MPM = OptLevel == 0 ? PB.buildO0DefaultPipeline(OptimizationLevel::O0) :
+    PB.buildPerModuleDefaultPipeline(Levels[std::min(OptLevel, 3u)]);
+    if (WholeProgram) {
+        MPM.addPass(GlobalDCEPass()); // The -O0 pipeline has none, and inlining leaves more
+    }
+    MPM.run(M, MAM);
+    return true;
+}
+
+
+//===----------------------------------------------------------------------===//
+// Embedding API. A host program gets it with
+//   #define QADIN_NO_MAIN
+//   #include "Qadin.cpp"
+//===----------------------------------------------------------------------===//
+
+// Sets up everything the driver needs. With JIT, gates are compiled to native code
+// in this process as they're defined, and top-level expressions are run
+void QadinInit(bool JIT) {
+    install_binops();
+    InitializeTargetMachine(JIT ? "native" : MArch);
+
+    if (JIT) {
+        sys::DynamicLibrary::LoadLibraryPermanently(nullptr); // For dlsym on ourselves
+        TheJIT = ExitOnErr(QadinJIT::Create(PerfJIT, ServeWorkers > 0));
+        TheDylib = &TheJIT->getMainJITDylib();
+        for (auto &H : HostSymbols) {
+            ExitOnErr(TheJIT->defineAbsolute(H.first, H.second));
+        }
+    }
+
+    // Make the module, which holds all the code.
+    InitializeModule();
+}
+
+// Makes Fn callable from Qadin code as Name, which still needs an extern declaring
+// its prototype. Fn must be a C function taking and returning doubles (or the
+// pointer/length pairs bufs are passed as). Can be called before or after QadinInit.
+// Returns false if Name is already registered
+bool QadinRegisterHost(const std::string &Name, void *Fn) {
+    if (!HostSymbols.emplace(Name, Fn).second) {
+        return false;
+    }
+    if (TheJIT) {
+        ExitOnErr(TheJIT->defineAbsolute(Name, Fn));
+    }
+    return true;
+}
+
+// Compiles (and with the JIT, runs) Src as if it had been typed at the driver
+void QadinEval(const std::string &Src) {
+    FILE *In = fmemopen((void *)Src.data(), Src.size(), "r");
+    LexFrom(In);
+    getNextTok();
+    MainLoop();
+    fclose(In);
+    LexFrom(stdin);
+}
+
+// Address of a gate compiled by the JIT, or nullptr. Cast it to the gate's C type,
+// e.g. double (*)(double *, int64_t, double) for gate f(buf a k)
+void *QadinLookup(const std::string &Name) {
+    if (!TheJIT) {
+        return nullptr;
+    }
+    PhaseTimer T(ph_emit);
+    auto Sym = TheJIT->lookup(Name);
+    if (!Sym) {
+        consumeError(Sym.takeError());
+        return nullptr;
+    }
+    return (void *)(intptr_t)Sym->getAddress();
+}
+
+
+#ifndef QADIN_NO_MAIN
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/* Gate microbenchmarks, --bench=<gate>
+
+The gate is called through a small generated thunk,
+  void __bench_thunk(double *Args, double **Bufs, i64 BufLen, double *Out)
+which loads the arguments from memory on every call, so nothing about them is known
+when the gate is compiled, and stores the result so it can't be dropped. The thunk
+lives in its own module, so the gate isn't inlined into it either. Scalar and vecN
+arguments come from Args, one double per lane, and every buf argument gets an array
+of BufLen doubles of its own.
+*/
+
+typedef void (*BenchThunk)(double *, double **, int64_t, double *);
+
+static Function *CodegenBenchThunk(const std::string &Gate) {
+    Function *F = getFunction(Gate);
+    auto SI = Signatures.find(Gate);
+    if (!F || SI == Signatures.end()) {
+        return (Function*)LogErrorV("Unknown function to benchmark");
+    }
+
+    Type *DoubleTy = Type::getDoubleTy(*TheContext);
+    Type *DoublePtrTy = Type::getDoublePtrTy(*TheContext);
+    Type *IdxTy = Type::getInt64Ty(*TheContext);
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(*TheContext),
+    {DoublePtrTy, DoublePtrTy->getPointerTo(), IdxTy, DoublePtrTy}, false);
+    Function *Thunk = Function::Create(FT, Function::ExternalLinkage, "__bench_thunk",
+    TheModule.get());
+    Builder->SetInsertPoint(BasicBlock::Create(*TheContext, "entry", Thunk));
+
+    Value *Args = Thunk->getArg(0), *Bufs = Thunk->getArg(1);
+    std::vector<Value*> ArgsV;
+    unsigned Slot = 0, BufSlot = 0;
+    for (char C : SI->second.ArgTypes) {
+        QType Ty = (QType)C;
+        if (Ty == ty_buf) {
+            Value *P = Builder->CreateConstGEP1_32(DoublePtrTy, Bufs, BufSlot++);
+            ArgsV.push_back(Builder->CreateLoad(DoublePtrTy, P));
+            ArgsV.push_back(Thunk->getArg(2));
+            continue;
+        }
+        Value *P = Builder->CreateConstGEP1_32(DoubleTy, Args, Slot);
+        Type *ArgTy = LLVMTypeFor(Ty);
+        P = Builder->CreateBitCast(P, ArgTy->getPointerTo());
+        ArgsV.push_back(Builder->CreateAlignedLoad(ArgTy, P, Align(8)));
+        Slot += Ty;
+    }
+
+    Value *R = Builder->CreateCall(F, ArgsV);
+    Value *Out = Builder->CreateBitCast(Thunk->getArg(3), R->getType()->getPointerTo());
+    Builder->CreateAlignedStore(R, Out, Align(8));
+    Builder->CreateRetVoid();
+
+    verifyFunction(*Thunk);
+    return Thunk;
+}
+
+// Where cycles/call comes from. The core's own cycle counter through perf_event if
+// we're allowed to open it, otherwise the time stamp counter, which ticks at a
+// constant rate and so is only cycles at nominal frequency
+class CycleCounter {
+    int Fd = -1;
+
+    public:
+        CycleCounter() {
+#ifdef __linux__
+            struct perf_event_attr PE;
+            memset(&PE, 0, sizeof(PE));
+            PE.type = PERF_TYPE_HARDWARE;
+            PE.size = sizeof(PE);
+            PE.config = PERF_COUNT_HW_CPU_CYCLES;
+            PE.exclude_kernel = 1;
+            PE.exclude_hv = 1;
+            Fd = syscall(__NR_perf_event_open, &PE, 0, -1, -1, 0);
+#endif
+        }
+        ~CycleCounter() {
+            if (Fd >= 0) close(Fd);
+        }
+
+        const char *source() const {
+            if (Fd >= 0) return "perf_event";
+#if defined(__x86_64__) || defined(__i386__)
+            return "rdtsc";
+#else
+            return nullptr;
+#endif
+        }
+
+        uint64_t read() const {
+            uint64_t Count = 0;
+            if (Fd >= 0) {
+                if (::read(Fd, &Count, sizeof(Count)) != sizeof(Count)) Count = 0;
+                return Count;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            Count = __rdtsc();
+#endif
+            return Count;
+        }
+};
+
+struct BenchOptions {
+    const char *Gate = nullptr;
+    const char *Args = nullptr; // Comma separated, or nullptr for random
+    long Iters = 1000000; // Calls per repetition
+    int Reps = 10;
+    long BufLen = 1024;
+};
+
+static void PrintStats(const char *What, std::vector<double> &Samples) {
+    double Sum = 0, Min = Samples[0], Max = Samples[0];
+    for (double S : Samples) {
+        Sum += S;
+        Min = std::min(Min, S);
+        Max = std::max(Max, S);
+    }
+    double Mean = Sum / Samples.size(), Var = 0;
+    for (double S : Samples) {
+        Var += (S - Mean) * (S - Mean);
+    }
+    double StdDev = Samples.size() > 1 ? sqrt(Var / (Samples.size() - 1)) : 0;
+    printf("  %-12s mean %10.3f  stddev %8.3f (%4.1f%%)  min %10.3f  max %10.3f\n", What,
+    Mean, StdDev, Mean ? 100 * StdDev / Mean : 0, Min, Max);
+}
+
+static int RunGateBench(const BenchOptions &Opts) {
+    if (!CodegenBenchThunk(Opts.Gate)) {
+        return 1;
+    }
+    const std::string ArgTypes = Signatures[Opts.Gate].ArgTypes;
+    OptimizeModule(*TheModule);
+    ExitOnErr(TheJIT->addModule(orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+    InitializeModule();
+    BenchThunk Thunk;
+    {
+        PhaseTimer T(ph_emit);
+        Thunk = (BenchThunk)(intptr_t)ExitOnErr(TheJIT->lookup("__bench_thunk")).getAddress();
+    }
+
+    // Fixed seed, so runs at different -O levels or FP models see the same inputs
+    std::mt19937_64 Rng(1);
+    std::uniform_real_distribution<double> Uniform(0.0, 1.0);
+
+    std::vector<double> Args;
+    std::vector<std::vector<double>> BufData;
+    std::vector<double *> Bufs;
+    for (char C : ArgTypes) {
+        QType Ty = (QType)C;
+        if (Ty == ty_buf) {
+            BufData.emplace_back(Opts.BufLen);
+            for (double &D : BufData.back()) D = Uniform(Rng);
+            continue;
+        }
+        for (int i = 0; i < Ty; i++) Args.push_back(Uniform(Rng));
+    }
+    for (auto &B : BufData) Bufs.push_back(B.data());
+
+    if (Opts.Args) {
+        const char *P = Opts.Args;
+        for (double &A : Args) {
+            char *End;
+            A = strtod(P, &End);
+            if (End == P) {
+                fprintf(stderr, "--bench-args needs %zu numbers\n", Args.size());
+                return 1;
+            }
+            P = *End == ',' ? End + 1 : End;
+        }
+    }
+
+    double Out[8];
+    CycleCounter Cycles;
+    std::vector<double> NsPerCall, CyclesPerCall;
+
+    for (int Rep = -1; Rep < Opts.Reps; Rep++) { // Rep -1 warms up and isn't counted
+        auto T0 = std::chrono::steady_clock::now();
+        uint64_t C0 = Cycles.read();
+        for (long i = 0; i < Opts.Iters; i++) {
+            Thunk(Args.data(), Bufs.data(), Opts.BufLen, Out);
+        }
+        uint64_t C1 = Cycles.read();
+        auto T1 = std::chrono::steady_clock::now();
+
+        if (Rep >= 0) {
+            NsPerCall.push_back(std::chrono::duration<double, std::nano>(T1 - T0).count() / Opts.Iters);
+            CyclesPerCall.push_back((double)(C1 - C0) / Opts.Iters);
+        }
+    }
+
+    printf("%s: %d reps of %ld calls, -O%u, fp-model %s, result %f\n", Opts.Gate, Opts.Reps,
+    Opts.Iters, OptLevel, FPModel, Out[0]);
+    PrintStats("ns/call", NsPerCall);
+    if (Cycles.source()) {
+        printf("  (cycles from %s)\n", Cycles.source());
+        PrintStats("cycles/call", CyclesPerCall);
+    }
+    return 0;
+}
+
+
+/* Allocation counting for --time-report. Replacing these replaces them for the whole
+process, LLVM included */
+void *operator new(size_t Size) {
+    ThreadAllocs++;
+    ThreadAllocBytes += Size;
+    if (void *P = malloc(Size ? Size : 1)) {
+        return P;
+    }
+    fprintf(stderr, "operator new: failed to allocate\n");
+    abort();
+}
+void *operator new[](size_t Size) {
+    return operator new(Size);
+}
+void *operator new(size_t Size, const std::nothrow_t &) noexcept {
+    ThreadAllocs++;
+    ThreadAllocBytes += Size;
+    return malloc(Size ? Size : 1);
+}
+void *operator new[](size_t Size, const std::nothrow_t &) noexcept {
+    return operator new(Size, std::nothrow);
+}
+void operator delete(void *P) noexcept {
+    free(P);
+}
+void operator delete[](void *P) noexcept {
+    free(P);
+}
+void operator delete(void *P, size_t) noexcept {
+    free(P);
+}
+void operator delete[](void *P, size_t) noexcept {
+    free(P);
+}
+
+
+/* Ahead-of-time compilation, -c and -shared
+
+The module is split into Threads partitions (llvm::splitCodeGen), which are code
+generated in parallel, each on its own TargetMachine. The system linker then puts the
+partial objects back together, ld -r for -c and cc -shared for -shared. What comes
+out needs nothing from LLVM at runtime; externs are left for the final link. */
+static int EmitNative(const std::string &Out, bool Shared, unsigned Threads) {
+    PhaseTimer T(ph_emit);
+    bool Direct = !Shared && Threads == 1; // Nothing to link, write Out itself
+
+    std::vector<std::string> Parts;
+    std::vector<std::unique_ptr<raw_fd_ostream>> Streams;
+    std::vector<raw_pwrite_stream *> OSs;
+    for (unsigned i = 0; i < Threads; i++) {
+        Parts.push_back(Direct ? Out : Out + ".part" + std::to_string(i) + ".o");
+        std::error_code EC;
+        Streams.push_back(std::make_unique<raw_fd_ostream>(Parts.back(), EC, sys::fs::OF_None));
+        if (EC) {
+            errs() << Parts.back() << ": " << EC.message() << "\n";
+            return 1;
+        }
+        OSs.push_back(Streams.back().get());
+    }
+
+    splitCodeGen(*TheModule, OSs, {}, [] {return CreateTargetMachine(MArch);}, CGFT_ObjectFile);
+    Streams.clear(); // Closes the files
+    if (Direct) {
+        return 0;
+    }
+
+    // Run directly rather than through a shell, so paths can hold anything
+    const char *Linker = Shared ? "cc" : "ld";
+    std::vector<StringRef> Args = {Linker};
+    if (Shared) {
+        Args.push_back("-shared");
+    } else {
+        Args.push_back("-r");
+    }
+    Args.push_back("-o");
+    Args.push_back(Out);
+    for (auto &P : Parts) {
+        Args.push_back(P);
+    }
+    std::string Error;
+    int Status = -1;
+    auto Program = sys::findProgramByName(Linker);
+    if (Program) {
+        Status = sys::ExecuteAndWait(*Program, Args, None, {}, 0, 0, &Error);
+    } else {
+        Error = Program.getError().message();
+    }
+    for (auto &P : Parts) {
+        sys::fs::remove(P);
+    }
+    if (Status != 0) {
+        errs() << "Linking " << Out << " with " << Linker << " failed";
+        if (!Error.empty()) errs() << ": " << Error;
+        errs() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+
+/* --serve. The compile server, see server.h for what clients send it. The main
+thread accepts connections and queues them, and each of ServeWorkers threads takes
+one at a time and serves that session until it disconnects. Workers share the JIT
+(made Concurrent for this) and the imported libraries, and everything else they
+compile with is per thread already, TargetMachine included. */
+
+static std::mutex SessionsMutex;
+static std::condition_variable SessionsReady;
+static std::deque<int> Sessions; // Connections waiting for a worker
+static std::atomic<unsigned> SessionCount(0); // For naming JITDylibs
+
+// Forgets every gate, extern and import this thread has seen, and starts a new module
+static void ResetCompileState() {
+    Signatures.clear();
+    ImportedGates.clear();
+    Imports.clear();
+    ExternAddrs.clear();
+    InitializeModule();
+}
+
+// Compiles Src as if it had been typed at the driver, into the current session.
+// Returns false if there were errors. Everything meant for the user goes in Reply
+static bool ServeEval(const std::string &Src, std::string &Reply) {
+    ReplyOut = &Reply;
+    ErrorCount = 0;
+    if (!Src.empty()) {
+        FILE *In = fmemopen((void *)Src.data(), Src.size(), "r");
+        LexFrom(In);
+        getNextTok();
+        MainLoop();
+        fclose(In);
+    }
+    ReplyOut = nullptr;
+    return ErrorCount == 0;
+}
+
+// Compiles Src to an object, in Reply, with the session set aside meanwhile
+static bool ServeCompile(const std::string &Src, std::string &Reply) {
+    StringMap<Signature> SessionSignatures;
+    StringMap<ImportedGate> SessionImportedGates;
+    std::vector<const Library *> SessionImports;
+    std::map<std::string, void *> SessionExternAddrs;
+    std::swap(Signatures, SessionSignatures);
+    std::swap(ImportedGates, SessionImportedGates);
+    std::swap(Imports, SessionImports);
+    std::swap(ExternAddrs, SessionExternAddrs);
+    orc::JITDylib *Session = TheDylib;
+    TheDylib = nullptr;
+
+    InitializeModule();
+    bool Ok = ServeEval(Src, Reply);
+    if (Ok) {
+        ReplyOut = &Reply;
+        OptimizeModule(*TheModule);
+        ReplyOut = nullptr;
+        Ok = ErrorCount == 0;
+    }
+    if (Ok) {
+        SmallVector<char, 0> Buf;
+        EmitObject(*TheModule, Buf);
+        Reply.assign(Buf.data(), Buf.size());
+    }
+
+    TheDylib = Session;
+    Signatures = std::move(SessionSignatures);
+    ImportedGates = std::move(SessionImportedGates);
+    Imports = std::move(SessionImports);
+    ExternAddrs = std::move(SessionExternAddrs);
+    InitializeModule();
+    return Ok;
+}
+
+// A new JITDylib for this thread's session to compile into. False if it couldn't be made
+static bool StartSession() {
+    auto JD = TheJIT->createSession("session " + std::to_string(SessionCount++));
+    if (!JD) {
+        LogError(toString(JD.takeError()).c_str());
+        return false;
+    }
+    TheDylib = &*JD;
+    ResetCompileState();
+    return true;
+}
+
+static void EndSession() {
+    JITOk(TheJIT->removeSession(*TheDylib));
+    TheDylib = nullptr;
+    ResetCompileState();
+}
+
+static void ServeSession(int FD) {
+    if (!StartSession()) {
+        close(FD);
+        return;
+    }
+    MessageReader In(FD);
+    std::string Verb, Body;
+    while (In.read(Verb, Body)) {
+        std::string Reply;
+        bool Ok;
+        if (Verb == "eval") {
+            Ok = ServeEval(Body, Reply);
+        } else if (Verb == "compile") {
+            Ok = ServeCompile(Body, Reply);
+        } else if (Verb == "reset") {
+            EndSession();
+            Ok = StartSession();
+        } else {
+            Reply = "Unknown request " + Verb + "\n";
+            Ok = false;
+        }
+        if (!SendMessage(FD, Ok ? "ok" : "error", Reply) || !TheDylib) break;
+    }
+    if (TheDylib) EndSession();
+    close(FD);
+}
+
+static void ServeWorker() {
+    TheTargetMachine = CreateTargetMachine("native");
+    InitializeModule();
+    while (1) {
+        int FD;
+        {
+            std::unique_lock<std::mutex> Lock(SessionsMutex);
+            SessionsReady.wait(Lock, [] {return !Sessions.empty();});
+            FD = Sessions.front();
+            Sessions.pop_front();
+        }
+        if (FD < 0) return; // Shutting down
+        ServeSession(FD);
+    }
+}
+
+// Serves clients at Path until accepting fails. Returns the driver's exit code
+static int Serve(const char *Path) {
+    int Listener = ListenAt(Path);
+    if (Listener < 0) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // A client hanging up mid-reply is its own business
+
+    std::vector<std::thread> Workers;
+    for (unsigned i = 0; i < ServeWorkers; i++) {
+        Workers.emplace_back(ServeWorker);
+    }
+    fprintf(stderr, "Serving on %s with %u workers\n", Path, ServeWorkers);
+
+    while (1) {
+        int FD = accept(Listener, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        std::lock_guard<std::mutex> Lock(SessionsMutex);
+        Sessions.push_back(FD);
+        SessionsReady.notify_one();
+    }
+
+    {
+        std::lock_guard<std::mutex> Lock(SessionsMutex);
+        for (unsigned i = 0; i < ServeWorkers; i++) {
+            Sessions.push_back(-1);
+        }
+        SessionsReady.notify_all();
+    }
+    for (auto &W : Workers) {
+        W.join();
+    }
+    close(Listener);
+    unlink(Path);
+    return 1;
+}
+
+
+// Host callback the driver provides as an example, extern printd(x) to use it
+static double printd(double X) {
+    fprintf(stderr, "%f\n", X);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    bool dump_ast = false;
+    DumpFormat dump_format = dump_human;
+    bool jit = false;
+    BenchOptions bench;
+    const char *time_report_json = nullptr;
+    const char *trace_file = nullptr;
+    std::string out_file;
+    bool pipeline = false;
+    const char *serve = nullptr;
+    const char *save_ast = nullptr;
+    const char *load_ast = nullptr;
+    unsigned codegen_threads = std::max(1u, std::thread::hardware_concurrency());
+    int inline_threshold = -1;
+    int opt;
+
+    enum { opt_bench = 256, opt_bench_args, opt_bench_iters, opt_bench_reps, opt_bench_buflen,
+    opt_fp_model, opt_time_report, opt_time_report_json,
+    opt_trace, opt_perf, opt_shared, opt_march, opt_codegen_threads,
+    opt_emit, opt_stream_batch, opt_pipeline, opt_save_ast, opt_load_ast, opt_parse_only,
+    opt_serve, opt_serve_threads, opt_export, opt_inline_threshold, opt_dump_ast };
+    static struct option long_opts[] = {
+        {"bench", required_argument, nullptr, opt_bench},
+        {"bench-args", required_argument, nullptr, opt_bench_args},
+        {"bench-iters", required_argument, nullptr, opt_bench_iters},
+        {"bench-reps", required_argument, nullptr, opt_bench_reps},
+        {"bench-buflen", required_argument, nullptr, opt_bench_buflen},
+        {"fp-model", required_argument, nullptr, opt_fp_model},
+        {"time-report", no_argument, nullptr, opt_time_report},
+        {"time-report-json", required_argument, nullptr, opt_time_report_json},
+        {"trace", required_argument, nullptr, opt_trace},
+        {"perf", no_argument, nullptr, opt_perf},
+        {"shared", no_argument, nullptr, opt_shared},
+        {"march", required_argument, nullptr, opt_march},
+        {"codegen-threads", required_argument, nullptr, opt_codegen_threads},
+        {"emit", required_argument, nullptr, opt_emit},
+        {"stream-batch", required_argument, nullptr, opt_stream_batch},
+        {"pipeline", no_argument, nullptr, opt_pipeline},
+        {"save-ast", required_argument, nullptr, opt_save_ast},
+        {"load-ast", required_argument, nullptr, opt_load_ast},
+        {"parse-only", no_argument, nullptr, opt_parse_only},
+        {"dump-ast", required_argument, nullptr, opt_dump_ast},
+        {"serve", required_argument, nullptr, opt_serve},
+        {"serve-threads", required_argument, nullptr, opt_serve_threads},
+        {"export", required_argument, nullptr, opt_export},
+        {"inline-threshold", required_argument, nullptr, opt_inline_threshold},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    // -shared and -march= are spelled with one dash, like cc
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-shared") || !strncmp(argv[i], "-march=", 7)) {
+            argv[i] = strdup((std::string("-") + argv[i]).c_str());
+        }
+    }
+
+    while ((opt = getopt_long(argc, argv, "vjgcO:o:", long_opts, nullptr)) != -1) {
+        switch(opt) {
+            case 'v':
+                dump_ast = true;
+                dump_format = dump_human;
+                break;
+            case opt_dump_ast:
+                dump_ast = true;
+                if (!DumpFormatFromName(optarg, dump_format)) {
+                    fprintf(stderr, "--dump-ast is one of human, sexpr, json or dot\n");
+                    return 1;
+                }
+                break;
+            case 'j':
+                jit = true;
+                break;
+            case 'g':
+                DebugInfo = true;
+                break;
+            case 'O':
+                OptLevel = atoi(optarg);
+                break;
+            case 'c':
+                Emit = emit_obj;
+                break;
+            case 'o':
+                out_file = optarg;
+                break;
+            case opt_shared:
+                Emit = emit_shared;
+                break;
+            case opt_emit: {
+                const char *Modes[] = {"echo", "none", "ll", "bc", "bc-stream", "obj-stream", "qlib"};
+                int Mode = 0;
+                while (Mode < 7 && strcmp(optarg, Modes[Mode])) Mode++;
+                if (Mode == 7) {
+                    fprintf(stderr, "--emit is one of echo, none, ll, bc, bc-stream, obj-stream or qlib\n");
+                    return 1;
+                }
+                Emit = (EmitMode)Mode;
+                break;
+            }
+            case opt_march:
+                MArch = optarg;
+                break;
+            case opt_pipeline:
+                pipeline = true;
+                break;
+            case opt_save_ast:
+                save_ast = optarg;
+                SaveAST = std::make_unique<ASTWriter>();
+                break;
+            case opt_load_ast:
+                load_ast = optarg;
+                break;
+            case opt_serve:
+                serve = optarg;
+                break;
+            case opt_serve_threads:
+                ServeWorkers = std::max(1, atoi(optarg));
+                break;
+            case opt_parse_only:
+                ParseOnly = true;
+                break;
+            case opt_export: { // Comma separated, and can be given more than once
+                WholeProgram = true;
+                std::string Names = optarg;
+                for (size_t Start = 0, End; Start <= Names.size(); Start = End + 1) {
+                    End = std::min(Names.find(',', Start), Names.size());
+                    if (End > Start) Exports.insert(Names.substr(Start, End - Start));
+                }
+                break;
+            }
+            case opt_inline_threshold:
+                inline_threshold = std::max(0, atoi(optarg));
+                break;
+            case opt_stream_batch:
+                StreamBatch = std::max(1, atoi(optarg));
+                break;
+            case opt_codegen_threads:
+                codegen_threads = std::max(1, atoi(optarg));
+                break;
+            case opt_bench:
+                bench.Gate = optarg;
+                jit = true;
+                break;
+            case opt_bench_args:
+                bench.Args = optarg;
+                break;
+            case opt_bench_iters:
+                bench.Iters = std::max(1L, atol(optarg));
+                break;
+            case opt_bench_reps:
+                bench.Reps = std::max(1, atoi(optarg));
+                break;
+            case opt_bench_buflen:
+                bench.BufLen = std::max(0L, atol(optarg));
+                break;
+            case opt_fp_model:
+                if (strcmp(optarg, "strict") && strcmp(optarg, "contract") && strcmp(optarg, "fast")) {
+                    fprintf(stderr, "--fp-model is one of strict, contract or fast\n");
+                    return 1;
+                }
+                FPModel = optarg;
+                break;
+            case opt_time_report:
+                TimeReport = true;
+                break;
+            case opt_time_report_json:
+                TimeReport = true;
+                time_report_json = optarg;
+                break;
+            case opt_trace:
+                Tracing = true;
+                TraceEpoch = WallNow();
+                trace_file = optarg;
+                break;
+            case opt_perf:
+                PerfJIT = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-v] [-j] [-g] [-O<level>] [--fp-model=strict|contract|fast]\n"
+                "  [--emit=echo|none|ll|bc|bc-stream|obj-stream|qlib | -c | -shared] [-o <file>|-]\n"
+                "  [--stream-batch=N] [--pipeline] [--save-ast=<file>] [--load-ast=<file>] [--parse-only]\n"
+                "  [--dump-ast=human|sexpr|json|dot]\n"
+                "  [-march=native|<cpu>] [--codegen-threads=N] [--export=<gate>,...]"
+                " [--inline-threshold=N]\n"
+                "  [--serve=<socket> [--serve-threads=N]]\n"
+                "  [--bench=<gate> [--bench-args=x,y,...] [--bench-iters=N] [--bench-reps=N]"
+                " [--bench-buflen=N]]\n  [--time-report] [--time-report-json=<file>|-]\n  [--trace=<file>] [--perf]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (jit && Emit != emit_echo && Emit != emit_none) {
+        fprintf(stderr, "With -j or --bench, --emit can only be echo or none\n");
+        return 1;
+    }
+    if (WholeProgram && Exports.empty()) { // Everything would be internalized, then deleted
+        fprintf(stderr, "--export needs at least one gate name\n");
+        return 1;
+    }
+    if (WholeProgram && (jit || serve || Emit == emit_bc_stream || Emit == emit_obj_stream || Emit == emit_qlib)) {
+        fprintf(stderr, "--export needs the whole program at once: -c, -shared, or --emit=ll, bc,"
+        " echo or none, without -j or --serve\n");
+        return 1;
+    }
+    if (inline_threshold < 0 && WholeProgram) {
+        inline_threshold = WholeProgramInlineThreshold;
+    }
+    if (inline_threshold >= 0) {
+        std::string Arg = "-inline-threshold=" + std::to_string(inline_threshold);
+        const char *Args[] = {argv[0], Arg.c_str()};
+        cl::ParseCommandLineOptions(2, Args);
+    }
+    if (out_file.empty()) {
+        const char *Defaults[] = {"", "", "out.ll", "out.bc", "out.bc", "out.a", "out.qlib", "out.o",
+        "out.so"};
+        out_file = Defaults[Emit];
+    }
+    if (Emit == emit_ll || Emit == emit_bc || Emit == emit_bc_stream) {
+        std::error_code EC; // Buffered, unlike errs()
+        EmitOut = std::make_unique<raw_fd_ostream>(out_file, EC, Emit == emit_ll ?
+        sys::fs::OF_Text : sys::fs::OF_None);
+        if (EC) {
+            errs() << out_file << ": " << EC.message() << "\n";
+            return 1;
+        }
+    } else if (Emit == emit_obj_stream) {
+        EmitArchive = std::make_unique<ArchiveWriter>(out_file);
+        if (!EmitArchive->open()) {
+            return 1;
+        }
+    } else if (Emit == emit_qlib) {
+        EmitLibrary = std::make_unique<LibraryWriter>();
+        StreamBatch = 1;
+    }
+
+    QadinRegisterHost("printd", (void *)printd);
+    if (serve) {
+        Emit = emit_none; // Replies carry results and errors, nothing else is printed
+        if (!ServeWorkers) ServeWorkers = std::max(1u, std::thread::hardware_concurrency());
+        QadinInit(true);
+        return Serve(serve);
+    }
+    ServeWorkers = 0;
+    QadinInit(jit);
+    if (dump_ast) {
+        Dumper = std::make_unique<ASTDumper>(dump_format);
+    }
+
+    if (load_ast) {
+        if (!LoadASTLoop(load_ast)) {
+            return 1;
+        }
+    } else if (pipeline) {
+        PipelineLoop();
+    } else {
+        // Prime the first token.
+        if (Emit == emit_echo) fprintf(stderr, "Qadin> ");
+        getNextTok();
+
+        // Run the main "interpreter loop" now.
+        MainLoop();
+    }
+    if (Dumper) {
+        Dumper->end();
+    }
+
+    int ret = 0;
+    if (bench.Gate) {
+        ret = RunGateBench(bench);
+    } else if (ParseOnly) {
+        // Nothing was compiled, so there's nothing to write out
+    } else if (Emit == emit_obj || Emit == emit_shared) {
+        ret = OptimizeModule(*TheModule) ? EmitNative(out_file, Emit == emit_shared,
+        codegen_threads) : 1;
+    } else if (Emit == emit_bc_stream || Emit == emit_obj_stream || Emit == emit_qlib) {
+        StreamModule(true);
+        if (EmitArchive && !EmitArchive->finish()) {
+            ret = 1;
+        }
+        if (EmitLibrary && !EmitLibrary->write(out_file.c_str())) {
+            ret = 1;
+        }
+    } else if (!OptimizeModule(*TheModule)) {
+        ret = 1;
+    } else {
+        PhaseTimer T(ph_output);
+        if (Emit == emit_echo) { // Print out all of the generated code.
+            TheModule->print(errs(), nullptr);
+        } else if (Emit == emit_ll) {
+            TheModule->print(*EmitOut, nullptr);
+        } else if (Emit == emit_bc) {
+            WriteBitcodeToFile(*TheModule, *EmitOut);
+        }
+    }
+    if (EmitOut) {
+        EmitOut->close();
+        if (EmitOut->has_error()) {
+            errs() << out_file << ": " << EmitOut->error().message() << "\n";
+            EmitOut->clear_error();
+            ret = 1;
+        }
+    }
+    if (save_ast) {
+        PhaseTimer T(ph_output);
+        if (!SaveAST->write(save_ast)) {
+            ret = 1;
+        }
+    }
+
+    if (TimeReport && !time_report_json) {
+        PrintTimeReport(stderr);
+    } else if (time_report_json) {
+        FILE *F = strcmp(time_report_json, "-") ? fopen(time_report_json, "w") : stdout;
+        if (!F) {
+            perror(time_report_json);
+            return 1;
+        }
+        WriteTimeReportJSON(F);
+        if (F != stdout) fclose(F);
+    }
+    if (trace_file) {
+        FILE *F = fopen(trace_file, "w");
+        if (!F) {
+            perror(trace_file);
+            return 1;
+        }
+        WriteTraceJSON(F);
+        fclose(F);
+    }
+
+    return ret;
+}
+
+#endif // QADIN_NO_MAIN
\ No newline at end of file
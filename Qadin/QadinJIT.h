@@ -0,0 +1,148 @@
+/* JIT for simple Qadin language
+10/18/2026
+Adin Gitig
+Sources: https://llvm.org/docs/tutorial/MyFirstLanguageFrontend/LangImpl04.html
+*/
+
+using namespace llvm;
+
+
+/* Writes /tmp/perf-<pid>.map, which perf reads to name addresses in JIT'd code, one
+"start size name" line per function as each object is loaded. Nothing is removed
+when code is freed, so a top-level expression's __anon_expr shows up once per run. */
+class PerfMapListener : public JITEventListener {
+    FILE *Map = nullptr;
+    std::mutex Lock;
+
+    public:
+        ~PerfMapListener() {
+            if (Map) fclose(Map);
+        }
+
+        void notifyObjectLoaded(ObjectKey, const object::ObjectFile &Obj,
+        const RuntimeDyld::LoadedObjectInfo &L) override {
+            // The debug object has every symbol at the address it was loaded at
+            object::OwningBinary<object::ObjectFile> DebugObj = L.getObjectForDebug(Obj);
+            if (!DebugObj.getBinary()) return;
+
+            std::lock_guard<std::mutex> Guard(Lock);
+            if (!Map) {
+                std::string Path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+                if (!(Map = fopen(Path.c_str(), "a"))) return;
+            }
+            for (auto &P : object::computeSymbolSizes(*DebugObj.getBinary())) {
+                auto Type = P.first.getType();
+                auto Name = P.first.getName();
+                auto Addr = P.first.getAddress();
+                if (!Type || !Name || !Addr || *Type != object::SymbolRef::ST_Function) {
+                    consumeError(Type.takeError());
+                    consumeError(Name.takeError());
+                    consumeError(Addr.takeError());
+                    continue;
+                }
+                fprintf(Map, "%llx %llx %s\n", (unsigned long long)*Addr,
+                (unsigned long long)P.second, Name->str().c_str());
+            }
+            fflush(Map); // perf may read it while we're still running
+        }
+};
+
+
+/* A thin layer over ORC's LLJIT. Gates are compiled eagerly, so nothing goes through
+lazy compile stubs. Symbols are looked up in this order:
+1. Modules we've added
+2. Host functions defined with defineAbsolute (see QadinRegisterHost)
+3. The process itself, through dlsym
+
+Externs that are already known at codegen time don't get this far at all, CallExprAST
+calls their address directly.
+
+With Perf, JIT'd functions are made visible to perf: by name in /tmp/perf-<pid>.map,
+and through LLVM's jitdump listener (for perf record -k 1 and perf inject --jit),
+which also carries the line table when the module has debug info.
+
+With Concurrent, modules can be added and looked up from many threads at once (the
+compile server does), so each compile gets a TargetMachine of its own rather than
+sharing one. Each of the server's sessions goes in a JITDylib of its own, which
+sees the main one's symbols but not any other session's. */
+class QadinJIT {
+    std::unique_ptr<orc::LLJIT> J;
+
+    QadinJIT(std::unique_ptr<orc::LLJIT> J) : J(std::move(J)) {}
+
+    public:
+        static Expected<std::unique_ptr<QadinJIT>> Create(bool Perf = false,
+        bool Concurrent = false) {
+            orc::LLJITBuilder Builder;
+            if (Concurrent) {
+                Builder.setCompileFunctionCreator([](orc::JITTargetMachineBuilder JTMB)
+                -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+                    return std::make_unique<orc::ConcurrentIRCompiler>(std::move(JTMB));
+                });
+            }
+            if (Perf) {
+                Builder.setObjectLinkingLayerCreator([](orc::ExecutionSession &ES, const Triple &) {
+                    auto L = std::make_unique<orc::RTDyldObjectLinkingLayer>(ES, []() {
+                        return std::make_unique<SectionMemoryManager>();
+                    });
+                    static PerfMapListener PerfMap;
+                    L->registerJITEventListener(PerfMap);
+                    if (auto *JitDump = JITEventListener::createPerfJITEventListener()) {
+                        L->registerJITEventListener(*JitDump);
+                    }
+                    return Expected<std::unique_ptr<orc::ObjectLayer>>(std::move(L));
+                });
+            }
+            auto J = Builder.create();
+            if (!J) {
+                return J.takeError();
+            }
+
+            auto Gen = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            (*J)->getDataLayout().getGlobalPrefix());
+            if (!Gen) {
+                return Gen.takeError();
+            }
+            (*J)->getMainJITDylib().addGenerator(std::move(*Gen));
+
+            return std::unique_ptr<QadinJIT>(new QadinJIT(std::move(*J)));
+        }
+
+        const DataLayout &getDataLayout() const {return J->getDataLayout();}
+        orc::JITDylib &getMainJITDylib() {return J->getMainJITDylib();}
+
+        Error addModule(orc::ThreadSafeModule TSM, orc::ResourceTrackerSP RT = nullptr) {
+            if (!RT) {
+                RT = J->getMainJITDylib().getDefaultResourceTracker();
+            }
+            return J->addIRModule(RT, std::move(TSM));
+        }
+
+        Expected<JITEvaluatedSymbol> lookup(StringRef Name) {
+            return J->lookup(Name);
+        }
+        Expected<JITEvaluatedSymbol> lookup(orc::JITDylib &JD, StringRef Name) {
+            return J->lookup(JD, Name);
+        }
+
+        // A fresh JITDylib for a session, falling back on the main one for anything
+        // it doesn't define itself
+        Expected<orc::JITDylib &> createSession(StringRef Name) {
+            auto JD = J->createJITDylib(Name.str());
+            if (JD) {
+                JD->addToLinkOrder(J->getMainJITDylib());
+            }
+            return JD;
+        }
+        // Frees everything compiled into a session's JITDylib, and the JITDylib
+        Error removeSession(orc::JITDylib &JD) {
+            return J->getExecutionSession().removeJITDylib(JD);
+        }
+
+        // Makes Name resolve to Addr, without asking the process
+        Error defineAbsolute(StringRef Name, void *Addr) {
+            return J->getMainJITDylib().define(orc::absoluteSymbols({{J->mangleAndIntern(Name),
+            JITEvaluatedSymbol(pointerToJITTargetAddress(Addr),
+            JITSymbolFlags::Exported | JITSymbolFlags::Callable)}}));
+        }
+};
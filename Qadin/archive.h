@@ -0,0 +1,118 @@
+/* Static library (ar archive) writer for simple Qadin language
+10/18/2026
+Adin Gitig
+Sources: https://en.wikipedia.org/wiki/Ar_(Unix)
+
+Builds a .a one object at a time, for --emit=obj-stream, without holding the objects
+in memory. A linker wants the symbol index as the first member, but we only know it
+once every object is in, so members go to <out>.members as they come and the archive
+is put together at finish(): header, index, then the members copied across. All we
+keep meanwhile is the name of each global symbol and where its member starts.
+
+The format is the System V/GNU one that ld and ar read on Linux.
+*/
+
+using namespace std;
+
+
+class ArchiveWriter {
+    string Path, MembersPath;
+    FILE *Members = nullptr;
+    uint64_t MembersSize = 0; // Bytes written to Members so far
+    unsigned Count = 0;
+    vector<pair<string, uint64_t>> Symbols; // Name, offset of its member in Members
+
+    // The fixed 60 byte header every member starts with. Name includes the '/' ending it
+    static void WriteHeader(FILE *F, const string &Name, uint64_t Size) {
+        fprintf(F, "%-16s%-12s%-6s%-6s%-8s%-10llu`\n", Name.c_str(), "0", "0", "0", "644",
+        (unsigned long long)Size);
+    }
+
+    static void WriteBE32(FILE *F, uint32_t V) {
+        unsigned char B[4] = {(unsigned char)(V >> 24), (unsigned char)(V >> 16),
+        (unsigned char)(V >> 8), (unsigned char)V};
+        fwrite(B, 1, 4, F);
+    }
+
+    public:
+        ArchiveWriter(const string &Path) : Path(Path), MembersPath(Path + ".members") {}
+
+        ~ArchiveWriter() {
+            if (Members) {
+                fclose(Members);
+                remove(MembersPath.c_str());
+            }
+        }
+
+        bool open() {
+            Members = fopen(MembersPath.c_str(), "wb");
+            if (!Members) perror(MembersPath.c_str());
+            return Members != nullptr;
+        }
+
+        // Adds one object, and the global symbols it defines to the index
+        void add(const char *Data, size_t Size, const vector<string> &Defined) {
+            for (auto &Name : Defined) {
+                Symbols.push_back({Name, MembersSize});
+            }
+            WriteHeader(Members, to_string(Count++) + ".o/", Size);
+            fwrite(Data, 1, Size, Members);
+            MembersSize += 60 + Size;
+            if (Size % 2) { // Members start on even offsets
+                fputc('\n', Members);
+                MembersSize++;
+            }
+        }
+
+        // Writes the archive itself. Returns false if something couldn't be written
+        bool finish() {
+            if (fclose(Members)) {
+                Members = nullptr;
+                perror(MembersPath.c_str());
+                return false;
+            }
+            Members = nullptr;
+
+            uint64_t IndexSize = 4 + 4 * Symbols.size();
+            for (auto &S : Symbols) {
+                IndexSize += S.first.size() + 1;
+            }
+            uint64_t IndexPad = IndexSize % 2;
+            uint64_t FirstMember = 8 + 60 + IndexSize + IndexPad;
+            if (FirstMember + MembersSize > UINT32_MAX) { // Index offsets are 32 bit
+                fprintf(stderr, "%s: archive is over 4GB\n", Path.c_str());
+                remove(MembersPath.c_str());
+                return false;
+            }
+
+            FILE *Out = fopen(Path.c_str(), "wb");
+            FILE *In = fopen(MembersPath.c_str(), "rb");
+            bool Ok = Out && In;
+            if (Ok) {
+                fputs("!<arch>\n", Out);
+                WriteHeader(Out, "/", IndexSize);
+                WriteBE32(Out, Symbols.size());
+                for (auto &S : Symbols) {
+                    WriteBE32(Out, FirstMember + S.second);
+                }
+                for (auto &S : Symbols) {
+                    fwrite(S.first.c_str(), 1, S.first.size() + 1, Out);
+                }
+                if (IndexPad) fputc('\n', Out);
+
+                char Buf[1 << 16];
+                size_t N;
+                while ((N = fread(Buf, 1, sizeof(Buf), In))) {
+                    fwrite(Buf, 1, N, Out);
+                }
+                Ok = !ferror(In) && !ferror(Out);
+            } else {
+                perror(Out ? MembersPath.c_str() : Path.c_str());
+            }
+
+            if (In) fclose(In);
+            if (Out && fclose(Out)) Ok = false;
+            remove(MembersPath.c_str());
+            return Ok;
+        }
+};
@@ -0,0 +1,625 @@
+/* AST dumper for simple Qadin language, -v and --dump-ast
+10/18/2026
+Adin Gitig
+Sources: https://graphviz.org/doc/info/lang.html
+
+Writes out each item as it's compiled, in one of
+  human  what -v has always printed
+  sexpr  an S-expression per item, e.g. (gate f ((x double)) double (+ x (call g 1)))
+  json   JSON Lines, an object per item, with every node's kind, line and column
+  dot    a Graphviz digraph of the whole program, a tree per item
+Output collects in a buffer and goes out in big writes, or after every item when it's
+a terminal so -v stays interactive. Expressions are walked with an explicit stack,
+kept from item to item, so nesting depth costs nothing and once the stack has grown
+nothing is allocated.
+*/
+
+enum DumpFormat { dump_human, dump_sexpr, dump_json, dump_dot };
+
+static bool DumpFormatFromName(const char *Name, DumpFormat &Format) {
+    const char *Names[] = {"human", "sexpr", "json", "dot"};
+    for (int i = 0; i < 4; i++) {
+        if (!strcmp(Name, Names[i])) {
+            Format = (DumpFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+class ASTDumper {
+    struct Frame {
+        const ExprAST *E;
+        size_t Next; // The kid to write next
+        unsigned Id; // Its dot node
+    };
+
+    DumpFormat Format;
+    FILE *Out;
+    bool Interactive;
+    std::vector<Frame> Stack;
+    unsigned Nodes = 0; // dot nodes so far
+    size_t Len = 0;
+    char Buf[1 << 16];
+
+    void flush() {
+        if (Len) fwrite(Buf, 1, Len, Out);
+        Len = 0;
+    }
+
+    void put(char C) {
+        if (Len == sizeof(Buf)) flush();
+        Buf[Len++] = C;
+    }
+
+    void put(const char *S, size_t N) {
+        if (N > sizeof(Buf) - Len) {
+            flush();
+            if (N > sizeof(Buf)) {
+                fwrite(S, 1, N, Out);
+                return;
+            }
+        }
+        memcpy(Buf + Len, S, N);
+        Len += N;
+    }
+
+    void put(const char *S) {put(S, strlen(S));}
+    void put(const std::string &S) {put(S.data(), S.size());}
+
+    void putInt(long long V) {
+        char Digits[24];
+        int N = sizeof(Digits);
+        unsigned long long U = V < 0 ? 0 - (unsigned long long)V : V;
+        do {
+            Digits[--N] = '0' + U % 10;
+            U /= 10;
+        } while (U);
+        if (V < 0) Digits[--N] = '-';
+        put(Digits + N, sizeof(Digits) - N);
+    }
+
+    // V in millionths, when that's exact to six decimals, as the usual literals are. With
+    // |V| < 1e9 a double is far closer than 5e-7 to the M / 1e6 it came from, so %f
+    // prints M's digits and no shorter decimal reads back as V
+    static bool Millionths(double V, long long &M) {
+        if (!(V > -1e9 && V < 1e9) || (V == 0 && std::signbit(V))) return false;
+        M = llround(V * 1e6);
+        return M / 1e6 == V;
+    }
+
+    // The whole and fractional parts of M millionths, without trailing zeros if Trim
+    void putMillionths(long long M, bool Trim) {
+        if (M < 0) {
+            put('-');
+            M = -M;
+        }
+        putInt(M / 1000000);
+        long long Frac = M % 1000000;
+        int Digits = 6;
+        while (Trim && Digits && Frac % 10 == 0) {
+            Frac /= 10;
+            Digits--;
+        }
+        if (!Digits) return;
+        char Tmp[7] = {'.'};
+        for (int i = Digits; i > 0; i--) {
+            Tmp[i] = '0' + Frac % 10;
+            Frac /= 10;
+        }
+        put(Tmp, Digits + 1);
+    }
+
+    // As %f, which -v has always used
+    void putFixed(double V) {
+        long long M;
+        if (Millionths(V, M)) {
+            putMillionths(M, false);
+            return;
+        }
+        char Tmp[512]; // %f of 1e308 is 316 characters
+        put(Tmp, snprintf(Tmp, sizeof(Tmp), "%f", V));
+    }
+
+    // The shortest form that reads back as V
+    void putShortest(double V) {
+        long long M;
+        if (Millionths(V, M)) {
+            putMillionths(M, true);
+            return;
+        }
+        char Tmp[32];
+        int N = 0;
+        for (int Digits = 15; Digits <= 17; Digits++) {
+            N = snprintf(Tmp, sizeof(Tmp), "%.*g", Digits, V);
+            if (strtod(Tmp, nullptr) == V) break;
+        }
+        put(Tmp, N);
+    }
+
+    // Escaped for a JSON or dot string
+    void putEscaped(const char *S, size_t N) {
+        for (size_t i = 0; i < N; i++) {
+            unsigned char C = S[i];
+            if (C == '"' || C == '\\') {
+                put('\\');
+                put(C);
+            } else if (C < 0x20) {
+                char Tmp[8];
+                put(Tmp, snprintf(Tmp, sizeof(Tmp), "\\u%04x", C));
+            } else {
+                put(C);
+            }
+        }
+    }
+
+    void putQuoted(const char *S, size_t N) {
+        put('"');
+        putEscaped(S, N);
+        put('"');
+    }
+
+    void putQuoted(const std::string &S) {putQuoted(S.data(), S.size());}
+
+    void putLoc(SourceLocation L) {
+        put("\"line\":");
+        putInt(L.Line);
+        put(",\"col\":");
+        putInt(L.Col);
+    }
+
+    // name(x, vec4 v) : vec4, as -v writes a prototype and dot labels one
+    void putSignature(const PrototypeAST &P) {
+        put(P.getName());
+        put('(');
+        for (size_t i = 0; i < P.getArgs().size(); i++) {
+            if (i) put(", ", 2);
+            if (P.getArgTypes()[i] != ty_double) {
+                put(TypeName(P.getArgTypes()[i]));
+                put(' ');
+            }
+            put(P.getArgs()[i]);
+        }
+        put(')');
+        if (P.getRetType() != ty_double) {
+            put(" : ", 3);
+            put(TypeName(P.getRetType()));
+        }
+    }
+
+    // (gate f ((x double)) double, leaving the paren open
+    void putSExprProto(const char *Item, const PrototypeAST &P) {
+        put('(');
+        put(Item);
+        put(' ');
+        put(P.getName());
+        put(" (", 2);
+        for (size_t i = 0; i < P.getArgs().size(); i++) {
+            if (i) put(' ');
+            put('(');
+            put(P.getArgs()[i]);
+            put(' ');
+            put(TypeName(P.getArgTypes()[i]));
+            put(')');
+        }
+        put(") ", 2);
+        put(TypeName(P.getRetType()));
+    }
+
+    // The start of a proto's object, up to the comma that follows ret
+    void putJSONProto(const char *Item, const PrototypeAST &P) {
+        put("{\"item\":\"");
+        put(Item);
+        put("\",\"name\":");
+        putQuoted(P.getName());
+        put(",\"line\":");
+        putInt(P.getLine());
+        put(",\"params\":[");
+        for (size_t i = 0; i < P.getArgs().size(); i++) {
+            if (i) put(',');
+            put("{\"name\":");
+            putQuoted(P.getArgs()[i]);
+            put(",\"type\":\"");
+            put(TypeName(P.getArgTypes()[i]));
+            put("\"}");
+        }
+        put("],\"ret\":\"");
+        put(TypeName(P.getRetType()));
+        put('"');
+    }
+
+    // A dot node, and the edge to it from its parent unless it's an item's
+    unsigned putDotNode(unsigned Parent, bool Box) {
+        unsigned Id = Nodes++;
+        if (Parent != ~0u) {
+            put("  n", 3);
+            putInt(Parent);
+            put(" -> n", 5);
+            putInt(Id);
+            put(";\n", 2);
+        }
+        put("  n", 3);
+        putInt(Id);
+        put(Box ? " [shape=box, label=\"" : " [label=\"");
+        return Id;
+    }
+
+    void endDotNode() {put("\"];\n");}
+
+    // Everything before E's first kid
+    void open(const ExprAST &E, unsigned Parent) {
+        unsigned Id = 0;
+        switch (Format) {
+            case dump_human:
+                switch (E.kind()) {
+                    case expr_number:
+                        put("(Number = ");
+                        putFixed(static_cast<const NumberExprAST &>(E).getVal());
+                        put(')');
+                        break;
+                    case expr_variable:
+                        put("(id = ");
+                        put(static_cast<const VariableExprAST &>(E).getName());
+                        put(')');
+                        break;
+                    case expr_binary:
+                        put("Binary Expr: ");
+                        break;
+                    case expr_index:
+                        put(static_cast<const IndexExprAST &>(E).getBufName());
+                        put('[');
+                        break;
+                    case expr_store:
+                        put(static_cast<const StoreExprAST &>(E).getBufName());
+                        put('[');
+                        break;
+                    case expr_call:
+                        put(static_cast<const CallExprAST &>(E).getCallee());
+                        put('(');
+                        break;
+                    case expr_if:
+                        put("If: [");
+                        break;
+                    case expr_for:
+                        put("For: [");
+                        put(static_cast<const ForExprAST &>(E).getVarName());
+                        put(" = ");
+                        break;
+                }
+                break;
+
+            case dump_sexpr:
+                switch (E.kind()) {
+                    case expr_number:
+                        putShortest(static_cast<const NumberExprAST &>(E).getVal());
+                        break;
+                    case expr_variable:
+                        put(static_cast<const VariableExprAST &>(E).getName());
+                        break;
+                    case expr_binary:
+                        put('(');
+                        put(static_cast<const BinaryExprAST &>(E).getOp());
+                        break;
+                    case expr_index:
+                        put("(index ");
+                        put(static_cast<const IndexExprAST &>(E).getBufName());
+                        break;
+                    case expr_store:
+                        put("(store ");
+                        put(static_cast<const StoreExprAST &>(E).getBufName());
+                        break;
+                    case expr_call:
+                        put("(call ");
+                        put(static_cast<const CallExprAST &>(E).getCallee());
+                        break;
+                    case expr_if:
+                        put("(if");
+                        break;
+                    case expr_for:
+                        put("(for ");
+                        put(static_cast<const ForExprAST &>(E).getVarName());
+                        break;
+                }
+                break;
+
+            case dump_json: {
+                const char *Kinds[] = {"number", "variable", "binary", "index", "store", "call",
+                "if", "for"};
+                put("{\"kind\":\"");
+                put(Kinds[E.kind()]);
+                put("\",");
+                putLoc(E.getLoc());
+                switch (E.kind()) {
+                    case expr_number: {
+                        double V = static_cast<const NumberExprAST &>(E).getVal();
+                        put(",\"value\":");
+                        if (std::isfinite(V)) {
+                            putShortest(V);
+                        } else {
+                            put("null"); // JSON has no infinities
+                        }
+                        break;
+                    }
+                    case expr_variable:
+                        put(",\"name\":");
+                        putQuoted(static_cast<const VariableExprAST &>(E).getName());
+                        break;
+                    case expr_binary: {
+                        char Op = static_cast<const BinaryExprAST &>(E).getOp();
+                        put(",\"op\":");
+                        putQuoted(&Op, 1);
+                        break;
+                    }
+                    case expr_index:
+                        put(",\"buf\":");
+                        putQuoted(static_cast<const IndexExprAST &>(E).getBufName());
+                        break;
+                    case expr_store:
+                        put(",\"buf\":");
+                        putQuoted(static_cast<const StoreExprAST &>(E).getBufName());
+                        break;
+                    case expr_call:
+                        put(",\"callee\":");
+                        putQuoted(static_cast<const CallExprAST &>(E).getCallee());
+                        break;
+                    case expr_if:
+                        break;
+                    case expr_for:
+                        put(",\"var\":");
+                        putQuoted(static_cast<const ForExprAST &>(E).getVarName());
+                        break;
+                }
+                if (E.kind() != expr_number && E.kind() != expr_variable) {
+                    put(",\"kids\":[");
+                }
+                break;
+            }
+
+            case dump_dot:
+                Id = putDotNode(Parent, false);
+                switch (E.kind()) {
+                    case expr_number:
+                        putShortest(static_cast<const NumberExprAST &>(E).getVal());
+                        break;
+                    case expr_variable:
+                        put(static_cast<const VariableExprAST &>(E).getName());
+                        break;
+                    case expr_binary: {
+                        char Op = static_cast<const BinaryExprAST &>(E).getOp();
+                        putEscaped(&Op, 1);
+                        break;
+                    }
+                    case expr_index:
+                        put(static_cast<const IndexExprAST &>(E).getBufName());
+                        put("[]");
+                        break;
+                    case expr_store:
+                        put(static_cast<const StoreExprAST &>(E).getBufName());
+                        put("[] =");
+                        break;
+                    case expr_call:
+                        put(static_cast<const CallExprAST &>(E).getCallee());
+                        put("()");
+                        break;
+                    case expr_if:
+                        put("if");
+                        break;
+                    case expr_for:
+                        put("for ");
+                        put(static_cast<const ForExprAST &>(E).getVarName());
+                        break;
+                }
+                endDotNode();
+                break;
+        }
+        Stack.push_back({&E, 0, Id});
+    }
+
+    // What goes before E's kid I
+    void between(const ExprAST &E, size_t I) {
+        switch (Format) {
+            case dump_human:
+                if (!I) return;
+                switch (E.kind()) {
+                    case expr_binary:
+                        put(' ');
+                        put(static_cast<const BinaryExprAST &>(E).getOp());
+                        put(' ');
+                        break;
+                    case expr_store:
+                        put("] = ");
+                        break;
+                    case expr_call:
+                        put(", ");
+                        break;
+                    case expr_if:
+                        put(I == 1 ? "] Then: [" : "] Else: [");
+                        break;
+                    case expr_for:
+                        put(I == E.numKids() - 1 ? "] Body: [" : ", ");
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case dump_sexpr:
+                put(' ');
+                break;
+            case dump_json:
+                if (I) put(',');
+                break;
+            case dump_dot:
+                break;
+        }
+    }
+
+    // Everything after E's last kid
+    void close(const ExprAST &E) {
+        switch (Format) {
+            case dump_human:
+                if (E.kind() == expr_index || E.kind() == expr_if || E.kind() == expr_for) {
+                    put(']');
+                } else if (E.kind() == expr_call) {
+                    put(')');
+                }
+                break;
+            case dump_sexpr:
+                if (E.kind() != expr_number && E.kind() != expr_variable) put(')');
+                break;
+            case dump_json:
+                if (E.kind() != expr_number && E.kind() != expr_variable) put(']');
+                put('}');
+                break;
+            case dump_dot:
+                break;
+        }
+    }
+
+    void expression(const ExprAST &Root, unsigned Parent) {
+        open(Root, Parent);
+        while (!Stack.empty()) {
+            Frame &F = Stack.back();
+            if (F.Next == F.E->numKids()) {
+                close(*F.E);
+                Stack.pop_back();
+                continue;
+            }
+            size_t I = F.Next++;
+            between(*F.E, I);
+            open(*F.E->kid(I), F.Id); // F may move
+        }
+    }
+
+    void endItem() {
+        if (Interactive) {
+            flush();
+            fflush(Out);
+        }
+    }
+
+    public:
+        ASTDumper(DumpFormat Format, FILE *Out = stdout) :
+        Format(Format), Out(Out), Interactive(isatty(fileno(Out))) {
+            if (Format == dump_dot) put("digraph AST {\n  graph [ordering=out];\n");
+        }
+
+        void gate(const FunctionAST &F) {
+            const PrototypeAST &P = F.getProto();
+            switch (Format) {
+                case dump_human:
+                    put("Function:\n  Prototype: [");
+                    putSignature(P);
+                    put("]\n  Body: [");
+                    expression(F.getBody(), 0);
+                    put("]\n\n");
+                    break;
+                case dump_sexpr:
+                    putSExprProto("gate", P);
+                    put(' ');
+                    expression(F.getBody(), 0);
+                    put(")\n");
+                    break;
+                case dump_json:
+                    putJSONProto("gate", P);
+                    put(",\"body\":");
+                    expression(F.getBody(), 0);
+                    put("}\n");
+                    break;
+                case dump_dot: {
+                    unsigned Id = putDotNode(~0u, true);
+                    put("gate ");
+                    putSignature(P);
+                    endDotNode();
+                    expression(F.getBody(), Id);
+                    break;
+                }
+            }
+            endItem();
+        }
+
+        void externProto(const PrototypeAST &P) {
+            switch (Format) {
+                case dump_human:
+                    put("Prototype: [");
+                    putSignature(P);
+                    put("]\n");
+                    break;
+                case dump_sexpr:
+                    putSExprProto("extern", P);
+                    put(")\n");
+                    break;
+                case dump_json:
+                    putJSONProto("extern", P);
+                    put("}\n");
+                    break;
+                case dump_dot:
+                    putDotNode(~0u, true);
+                    put("extern ");
+                    putSignature(P);
+                    endDotNode();
+                    break;
+            }
+            endItem();
+        }
+
+        // A top-level expression, wrapped in its __anon_expr gate
+        void expr(const FunctionAST &F) {
+            switch (Format) {
+                case dump_human:
+                    gate(F); // -v never told them apart
+                    return;
+                case dump_sexpr:
+                    put("(expr ");
+                    expression(F.getBody(), 0);
+                    put(")\n");
+                    break;
+                case dump_json:
+                    put("{\"item\":\"expr\",\"body\":");
+                    expression(F.getBody(), 0);
+                    put("}\n");
+                    break;
+                case dump_dot: {
+                    unsigned Id = putDotNode(~0u, true);
+                    put("expr");
+                    endDotNode();
+                    expression(F.getBody(), Id);
+                    break;
+                }
+            }
+            endItem();
+        }
+
+        void import(const std::string &Path) {
+            switch (Format) {
+                case dump_human:
+                    put("Import: [");
+                    put(Path);
+                    put("]\n");
+                    break;
+                case dump_sexpr:
+                    put("(import ");
+                    putQuoted(Path);
+                    put(")\n");
+                    break;
+                case dump_json:
+                    put("{\"item\":\"import\",\"path\":");
+                    putQuoted(Path);
+                    put("}\n");
+                    break;
+                case dump_dot:
+                    putDotNode(~0u, true);
+                    put("import ");
+                    putEscaped(Path.data(), Path.size());
+                    endDotNode();
+                    break;
+            }
+            endItem();
+        }
+
+        // Finishes the dump. Nothing more can be written after this
+        void end() {
+            if (Format == dump_dot) put("}\n");
+            flush();
+            fflush(Out);
+        }
+};
@@ -0,0 +1,475 @@
+/* Binary AST files for simple Qadin language, --save-ast and --load-ast
+10/18/2026
+Adin Gitig
+
+A parsed program, saved so that it can be compiled again without lexing or parsing.
+The file is mmap'd and every table is used in place, so loading costs a page-in plus
+building the AST objects codegen wants.
+
+Layout, in the host's byte order (the version check fails on anything else):
+  ASTFileHeader
+  items    ASTItem[NumItems]       gates, externs, imports and expressions, in source order
+  protos   ASTProto[NumProtos]
+  params   ASTParam[NumParams]     each proto's are consecutive
+  nodes    ASTNode[NumNodes]       expression nodes, children before their parents
+  extra    uint32_t[NumExtra]      children, node indices
+  strings  char[StrBytes]          every name once, each ending in a NUL
+Each table starts at the offset the header gives for it, 8 byte aligned.
+
+A node's children are a run of node indices in extra, and those nodes always come
+before it, so an item's nodes are the range [FirstNode, Body] and can be built in one
+pass with no recursion. Loading checks that every child is an earlier node in that
+range, used once, and that every string is in the table, so a damaged file is
+rejected rather than crashing codegen.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unordered_map>
+
+using namespace std;
+
+
+static const char ASTFileMagic[4] = {'Q', 'A', 'S', 'T'};
+static const uint32_t ASTFileVersion = 1 | ('L' << 24); // L: written little endian
+static const uint32_t NoNode = UINT32_MAX;
+
+enum ASTItemKind : uint32_t { item_gate, item_extern, item_expr, item_import };
+
+// Kid i below is node Extra[FirstKid + i]
+enum ASTNodeKind : uint8_t {
+    node_number,   // Num
+    node_variable, // Str
+    node_binary,   // Kid 0 Op kid 1
+    node_index,    // Str[kid 0]
+    node_store,    // Str[kid 0] = kid 1
+    node_call,     // Str(kids)
+    node_if,       // if kid 0 then kid 1 else kid 2
+    node_for,      // for Str = kid 0, kid 1 in kid 2, or with a step, kid 0, kid 1, kid 2 in kid 3
+};
+
+struct ASTFileHeader {
+    char Magic[4];
+    uint32_t Version;
+    uint32_t NumItems, NumProtos, NumParams, NumNodes, NumExtra, StrBytes;
+    uint64_t Items, Protos, Params, Nodes, Extra, Strings; // Offsets from the start
+};
+
+struct ASTItem {
+    ASTItemKind Kind;
+    uint32_t Proto;           // For an import, the string holding its path
+    uint32_t FirstNode, Body; // Both NoNode for an extern or an import
+};
+
+struct ASTProto {
+    uint32_t Name;
+    uint32_t FirstParam, NumParams;
+    uint32_t RetType;
+    uint32_t Line;
+};
+
+struct ASTParam {
+    uint32_t Name;
+    uint32_t Type;
+};
+
+struct ASTNode {
+    ASTNodeKind Kind;
+    uint8_t Op;
+    uint16_t NumKids;
+    uint32_t Line, Col;
+    uint32_t Str;
+    union {
+        double Num;        // node_number
+        uint32_t FirstKid; // Everything else
+    };
+};
+
+
+// Collects items as they're parsed, then writes them all out
+class ASTWriter {
+    vector<ASTItem> Items;
+    vector<ASTProto> Protos;
+    vector<ASTParam> Params;
+    vector<ASTNode> Nodes;
+    vector<uint32_t> Extra;
+    string Strings;
+    unordered_map<string, uint32_t> StringIndex;
+
+    void addFunction(ASTItemKind Kind, const FunctionAST &F) {
+        uint32_t First = Nodes.size();
+        uint32_t Body = F.serialize(*this);
+        Items.push_back({Kind, F.getProto().serialize(*this), First, Body});
+    }
+
+    template <typename T>
+    static bool WriteTable(FILE *Out, const vector<T> &Table, uint64_t Offset) {
+        return !fseek(Out, Offset, SEEK_SET) &&
+        fwrite(Table.data(), sizeof(T), Table.size(), Out) == Table.size();
+    }
+
+    public:
+        // Offset of S in the string table, adding it if it's new
+        uint32_t str(const string &S) {
+            auto It = StringIndex.find(S);
+            if (It != StringIndex.end()) {
+                return It->second;
+            }
+            uint32_t Offset = Strings.size();
+            Strings.append(S.c_str(), S.size() + 1);
+            StringIndex[S] = Offset;
+            return Offset;
+        }
+
+        // Adds a node whose children have all been added already
+        uint32_t add(ASTNodeKind Kind, SourceLocation Loc, const string *Str,
+        initializer_list<uint32_t> Kids = {}) {
+            return add(Kind, Loc, Str, Kids.begin(), Kids.size());
+        }
+
+        uint32_t add(ASTNodeKind Kind, SourceLocation Loc, const string *Str, const uint32_t *Kids,
+        size_t NumKids, uint8_t Op = 0) {
+            ASTNode N = {};
+            N.Kind = Kind;
+            N.Op = Op;
+            N.NumKids = NumKids;
+            N.Line = Loc.Line;
+            N.Col = Loc.Col;
+            N.Str = Str ? str(*Str) : NoNode;
+            N.FirstKid = Extra.size();
+            Extra.insert(Extra.end(), Kids, Kids + NumKids);
+            Nodes.push_back(N);
+            return Nodes.size() - 1;
+        }
+
+        uint32_t addNumber(SourceLocation Loc, double Val) {
+            ASTNode N = {};
+            N.Kind = node_number;
+            N.Line = Loc.Line;
+            N.Col = Loc.Col;
+            N.Str = NoNode;
+            N.Num = Val;
+            Nodes.push_back(N);
+            return Nodes.size() - 1;
+        }
+
+        uint32_t addProto(const ASTProto &P) {
+            Protos.push_back(P);
+            return Protos.size() - 1;
+        }
+
+        uint32_t addParam(const ASTParam &P) {
+            Params.push_back(P);
+            return Params.size() - 1;
+        }
+
+        // The nodes added so far, for searching a tree (document.h)
+        const vector<ASTNode> &nodes() const {return Nodes;}
+
+        void addGate(const FunctionAST &F) {addFunction(item_gate, F);}
+        void addExpr(const FunctionAST &F) {addFunction(item_expr, F);}
+        void addExtern(const PrototypeAST &P) {
+            Items.push_back({item_extern, P.serialize(*this), NoNode, NoNode});
+        }
+        void addImport(const string &Path) {
+            Items.push_back({item_import, str(Path), NoNode, NoNode});
+        }
+
+        bool write(const char *Path) {
+            ASTFileHeader H = {};
+            memcpy(H.Magic, ASTFileMagic, 4);
+            H.Version = ASTFileVersion;
+            H.NumItems = Items.size();
+            H.NumProtos = Protos.size();
+            H.NumParams = Params.size();
+            H.NumNodes = Nodes.size();
+            H.NumExtra = Extra.size();
+            H.StrBytes = Strings.size();
+
+            auto Align = [](uint64_t Off) {return (Off + 7) & ~(uint64_t)7;};
+            H.Items = Align(sizeof(H));
+            H.Protos = Align(H.Items + Items.size() * sizeof(ASTItem));
+            H.Params = Align(H.Protos + Protos.size() * sizeof(ASTProto));
+            H.Nodes = Align(H.Params + Params.size() * sizeof(ASTParam));
+            H.Extra = Align(H.Nodes + Nodes.size() * sizeof(ASTNode));
+            H.Strings = Align(H.Extra + Extra.size() * sizeof(uint32_t));
+
+            FILE *Out = fopen(Path, "wb");
+            if (!Out) {
+                perror(Path);
+                return false;
+            }
+            bool Ok = fwrite(&H, sizeof(H), 1, Out) == 1 && WriteTable(Out, Items, H.Items) &&
+            WriteTable(Out, Protos, H.Protos) && WriteTable(Out, Params, H.Params) &&
+            WriteTable(Out, Nodes, H.Nodes) && WriteTable(Out, Extra, H.Extra) &&
+            !fseek(Out, H.Strings, SEEK_SET) &&
+            fwrite(Strings.data(), 1, Strings.size(), Out) == Strings.size();
+            if (fclose(Out) || !Ok) {
+                perror(Path);
+                return false;
+            }
+            return true;
+        }
+};
+
+
+uint32_t NumberExprAST::serialize(ASTWriter &W) const {
+    return W.addNumber(getLoc(), Val);
+}
+
+uint32_t VariableExprAST::serialize(ASTWriter &W) const {
+    return W.add(node_variable, getLoc(), &IdName);
+}
+
+uint32_t BinaryExprAST::serialize(ASTWriter &W) const {
+    uint32_t Kids[2] = {left->serialize(W), right->serialize(W)};
+    return W.add(node_binary, getLoc(), nullptr, Kids, 2, Op);
+}
+
+uint32_t IndexExprAST::serialize(ASTWriter &W) const {
+    return W.add(node_index, getLoc(), &BufName, {Index->serialize(W)});
+}
+
+uint32_t StoreExprAST::serialize(ASTWriter &W) const {
+    uint32_t Kids[2] = {Index->serialize(W), Val->serialize(W)};
+    return W.add(node_store, getLoc(), &BufName, Kids, 2);
+}
+
+uint32_t CallExprAST::serialize(ASTWriter &W) const {
+    vector<uint32_t> Kids;
+    for (auto &Arg : Args) {
+        Kids.push_back(Arg->serialize(W));
+    }
+    return W.add(node_call, getLoc(), &Callee, Kids.data(), Kids.size());
+}
+
+uint32_t IfExprAST::serialize(ASTWriter &W) const {
+    uint32_t Kids[3] = {Cond->serialize(W), Then->serialize(W), Else->serialize(W)};
+    return W.add(node_if, getLoc(), nullptr, Kids, 3);
+}
+
+uint32_t ForExprAST::serialize(ASTWriter &W) const {
+    uint32_t Kids[4];
+    size_t N = 0;
+    Kids[N++] = Start->serialize(W);
+    Kids[N++] = End->serialize(W);
+    if (Step) {
+        Kids[N++] = Step->serialize(W);
+    }
+    Kids[N++] = Body->serialize(W);
+    return W.add(node_for, getLoc(), &VarName, Kids, N);
+}
+
+uint32_t PrototypeAST::serialize(ASTWriter &W) const {
+    ASTProto P = {W.str(Name), 0, (uint32_t)Args.size(), (uint32_t)RetType, (uint32_t)Line};
+    for (size_t i = 0; i < Args.size(); i++) {
+        uint32_t Idx = W.addParam({W.str(Args[i]), (uint32_t)ArgTypes[i]});
+        if (i == 0) P.FirstParam = Idx;
+    }
+    return W.addProto(P);
+}
+
+uint32_t FunctionAST::serialize(ASTWriter &W) const {
+    return Body->serialize(W);
+}
+
+
+// A saved program, mapped into memory. Items are turned back into ASTs one at a time
+class ASTFile {
+    void *Map = MAP_FAILED;
+    size_t Size = 0;
+    const ASTFileHeader *H = nullptr;
+    const ASTItem *Items;
+    const ASTProto *Protos;
+    const ASTParam *Params;
+    const ASTNode *Nodes;
+    const uint32_t *Extra;
+    const char *Strings;
+
+    // Whether Count records of Size bytes at Offset fit in the file
+    bool fits(uint64_t Offset, uint64_t Count, uint64_t Size) const {
+        return Offset % 8 == 0 && Offset <= this->Size && Count <= (this->Size - Offset) / Size;
+    }
+
+    // The string at Offset, or nullptr if it isn't one
+    const char *str(uint32_t Offset) const {
+        if (Offset >= H->StrBytes || !memchr(Strings + Offset, 0, H->StrBytes - Offset)) {
+            return nullptr;
+        }
+        return Strings + Offset;
+    }
+
+    static bool valid(uint32_t Type) {
+        return Type == ty_buf || Type == ty_double || Type == ty_vec2 || Type == ty_vec4 ||
+        Type == ty_vec8;
+    }
+
+    unique_ptr<PrototypeAST> proto(uint32_t Idx) const {
+        if (Idx >= H->NumProtos) {
+            return LogErrorP("Bad AST file: prototype out of range");
+        }
+        const ASTProto &P = Protos[Idx];
+        const char *Name = str(P.Name);
+        if (!Name || P.FirstParam > H->NumParams || P.NumParams > H->NumParams - P.FirstParam ||
+        !valid(P.RetType)) {
+            return LogErrorP("Bad AST file: broken prototype");
+        }
+
+        vector<string> Args;
+        vector<QType> Types;
+        for (uint32_t i = 0; i < P.NumParams; i++) {
+            const ASTParam &A = Params[P.FirstParam + i];
+            const char *ArgName = str(A.Name);
+            if (!ArgName || !valid(A.Type)) {
+                return LogErrorP("Bad AST file: broken parameter");
+            }
+            Args.push_back(ArgName);
+            Types.push_back((QType)A.Type);
+        }
+        auto Proto = make_unique<PrototypeAST>(Name, move(Args), move(Types), (QType)P.RetType);
+        Proto->setLine(P.Line);
+        return Proto;
+    }
+
+    public:
+        ~ASTFile() {
+            if (Map != MAP_FAILED) munmap(Map, Size);
+        }
+
+        static unique_ptr<ASTFile> open(const char *Path) {
+            int FD = ::open(Path, O_RDONLY);
+            if (FD < 0) {
+                perror(Path);
+                return nullptr;
+            }
+            struct stat St;
+            auto F = make_unique<ASTFile>();
+            if (fstat(FD, &St) == 0 && St.st_size >= (off_t)sizeof(ASTFileHeader)) {
+                F->Size = St.st_size;
+                F->Map = mmap(nullptr, F->Size, PROT_READ, MAP_PRIVATE, FD, 0);
+            }
+            close(FD);
+            if (F->Map == MAP_FAILED) {
+                fprintf(stderr, "%s: not an AST file\n", Path);
+                return nullptr;
+            }
+
+            const char *Base = (const char *)F->Map;
+            F->H = (const ASTFileHeader *)Base;
+            const ASTFileHeader &H = *F->H;
+            if (memcmp(H.Magic, ASTFileMagic, 4) || H.Version != ASTFileVersion) {
+                fprintf(stderr, "%s: not an AST file, or from another version\n", Path);
+                return nullptr;
+            }
+            if (!F->fits(H.Items, H.NumItems, sizeof(ASTItem)) ||
+            !F->fits(H.Protos, H.NumProtos, sizeof(ASTProto)) ||
+            !F->fits(H.Params, H.NumParams, sizeof(ASTParam)) ||
+            !F->fits(H.Nodes, H.NumNodes, sizeof(ASTNode)) ||
+            !F->fits(H.Extra, H.NumExtra, sizeof(uint32_t)) || !F->fits(H.Strings, H.StrBytes, 1)) {
+                fprintf(stderr, "%s: truncated AST file\n", Path);
+                return nullptr;
+            }
+            F->Items = (const ASTItem *)(Base + H.Items);
+            F->Protos = (const ASTProto *)(Base + H.Protos);
+            F->Params = (const ASTParam *)(Base + H.Params);
+            F->Nodes = (const ASTNode *)(Base + H.Nodes);
+            F->Extra = (const uint32_t *)(Base + H.Extra);
+            F->Strings = Base + H.Strings;
+            return F;
+        }
+
+        uint32_t size() const {return H->NumItems;}
+        ASTItemKind kind(uint32_t i) const {return Items[i].Kind;}
+
+        // Item i, if it's an extern
+        unique_ptr<PrototypeAST> externProto(uint32_t i) const {
+            return proto(Items[i].Proto);
+        }
+
+        // Item i's path, if it's an import. Empty if that's broken
+        string importPath(uint32_t i) const {
+            const char *Path = str(Items[i].Proto);
+            return Path ? Path : "";
+        }
+
+        // Item i, if it's a gate or an expression
+        unique_ptr<FunctionAST> function(uint32_t i) const {
+            const ASTItem &It = Items[i];
+            if (It.FirstNode > It.Body || It.Body >= H->NumNodes) {
+                LogError("Bad AST file: item's nodes out of range");
+                return nullptr;
+            }
+
+            // Built[n] is node FirstNode + n, until its parent takes it
+            vector<unique_ptr<ExprAST>> Built(It.Body - It.FirstNode + 1);
+            vector<unique_ptr<ExprAST>> K; // The children of the node being built
+
+            for (uint32_t n = It.FirstNode; n <= It.Body; n++) {
+                const ASTNode &N = Nodes[n];
+                const char *Str = N.Str == NoNode ? nullptr : str(N.Str);
+
+                K.clear();
+                if (N.Kind != node_number) {
+                    if (N.FirstKid > H->NumExtra || N.NumKids > H->NumExtra - N.FirstKid) {
+                        LogError("Bad AST file: children out of range");
+                        return nullptr;
+                    }
+                    for (uint32_t k = 0; k < N.NumKids; k++) {
+                        uint32_t Kid = Extra[N.FirstKid + k];
+                        if (Kid < It.FirstNode || Kid >= n || !Built[Kid - It.FirstNode]) {
+                            LogError("Bad AST file: child isn't an earlier, unused node");
+                            return nullptr;
+                        }
+                        K.push_back(move(Built[Kid - It.FirstNode]));
+                    }
+                }
+                bool Named = Str != nullptr;
+
+                unique_ptr<ExprAST> E;
+                switch (N.Kind) {
+                    case node_number:
+                        E = make_unique<NumberExprAST>(N.Num);
+                        break;
+                    case node_variable:
+                        if (Named && K.empty()) {
+                            string Name = Str;
+                            E = make_unique<VariableExprAST>(Name);
+                        }
+                        break;
+                    case node_binary:
+                        if (K.size() == 2) E = make_unique<BinaryExprAST>(N.Op, move(K[0]), move(K[1]));
+                        break;
+                    case node_index:
+                        if (Named && K.size() == 1) E = make_unique<IndexExprAST>(Str, move(K[0]));
+                        break;
+                    case node_store:
+                        if (Named && K.size() == 2) E = make_unique<StoreExprAST>(Str, move(K[0]), move(K[1]));
+                        break;
+                    case node_call:
+                        if (Named) E = make_unique<CallExprAST>(Str, move(K));
+                        break;
+                    case node_if:
+                        if (K.size() == 3) E = make_unique<IfExprAST>(move(K[0]), move(K[1]), move(K[2]));
+                        break;
+                    case node_for:
+                        if (Named && K.size() == 3) {
+                            E = make_unique<ForExprAST>(Str, move(K[0]), move(K[1]), nullptr, move(K[2]));
+                        } else if (Named && K.size() == 4) {
+                            E = make_unique<ForExprAST>(Str, move(K[0]), move(K[1]), move(K[2]), move(K[3]));
+                        }
+                        break;
+                }
+                if (!E) {
+                    LogError("Bad AST file: broken expression node");
+                    return nullptr;
+                }
+                E->setLoc({(int)N.Line, (int)N.Col});
+                Built[n - It.FirstNode] = move(E);
+            }
+
+            auto Proto = proto(It.Proto);
+            if (!Proto) return nullptr;
+            return make_unique<FunctionAST>(move(Proto), move(Built.back()));
+        }
+};
@@ -0,0 +1,308 @@
+/* Compiler throughput benchmarks for simple Qadin language
+10/18/2026
+Adin Gitig
+
+Each benchmark runs on programs from progen.h, over a few shapes. Run with
+  ./Qadin_bench --benchmark_out=bench.json --benchmark_out_format=json
+to get results you can diff between builds.
+
+BM_Lex       lexer() alone, bytes/s
+BM_Parse     lexing and parsing, AST nodes/s
+BM_Codegen   codegen() of already parsed gates into a fresh module, functions/s
+BM_Driver    the whole driver loop as Qadin_driver runs it, including its stderr
+             output (sent to /dev/null), at the -O level given, with --emit=echo
+             (emit=0) or --emit=none (emit=1)
+BM_Pipeline  the same with --pipeline, plus how full its queues ran; compare it
+             against BM_Driver with the same arguments
+BM_Dump      writing out parsed gates as -v and --dump-ast do (astdump.h), to
+             /dev/null, in format 0 human, 1 sexpr, 2 json or 3 dot, AST nodes/s
+BM_Edit      a keystroke and its undo in a gate halfway through the program, as the
+             language server reparses them (document.h), edits/s. Should stay flat as
+             the program grows
+*/
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+
+#define QADIN_NO_MAIN
+#include "Qadin.cpp"
+#include "progen.h"
+#include "document.h"
+
+
+static void ApplyShape(benchmark::State &state, ProgramShape &Shape) {
+    Shape.Gates = state.range(0);
+    Shape.Depth = state.range(1);
+    Shape.Width = state.range(2);
+    Shape.FanOut = state.range(3);
+    Shape.IdLen = state.range(4);
+}
+
+static void Shapes(benchmark::internal::Benchmark *B) {
+    B->ArgNames({"gates", "depth", "width", "fanout", "idlen"});
+    B->Args({100, 3, 3, 2, 8});     // Typical library
+    B->Args({1000, 3, 3, 2, 8});    // Many gates
+    B->Args({100, 6, 3, 2, 8});     // Deep expressions
+    B->Args({100, 3, 8, 2, 8});     // Wide expressions
+    B->Args({100, 3, 3, 16, 8});    // Heavy call fan-out
+    B->Args({100, 3, 3, 2, 64});    // Long identifiers
+}
+
+// Points the lexer at Src and primes CurTok. Returns the FILE* to close afterwards
+static FILE *StartFrontEnd(const std::string &Src) {
+    FILE *In = fmemopen((void *)Src.data(), Src.size(), "r");
+    LexFrom(In);
+    getNextTok();
+    return In;
+}
+
+static void BM_Lex(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+
+    size_t Toks = 0;
+    for (auto _ : state) {
+        FILE *In = fmemopen((void *)P.Src.data(), P.Src.size(), "r");
+        LexFrom(In);
+        while (lexer() != tok_eof) {
+            Toks++;
+        }
+        fclose(In);
+    }
+    LexFrom(stdin);
+
+    state.SetBytesProcessed(state.iterations() * P.Src.size());
+    state.counters["tokens/s"] = benchmark::Counter(Toks, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Lex)->Apply(Shapes);
+
+// Parses every top level item, keeping the gates and throwing the rest away
+static std::vector<std::unique_ptr<FunctionAST>> ParseAll() {
+    std::vector<std::unique_ptr<FunctionAST>> Gates;
+    while (CurTok != tok_eof) {
+        if (CurTok == ';') {
+            getNextTok();
+        } else if (CurTok == tok_gate) {
+            if (auto F = ParseDefn()) {
+                Gates.push_back(std::move(F));
+            } else {
+                getNextTok();
+            }
+        } else if (!ParseTopLevelExpr()) {
+            getNextTok();
+        }
+    }
+    return Gates;
+}
+
+static void BM_Parse(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+
+    for (auto _ : state) {
+        FILE *In = StartFrontEnd(P.Src);
+        benchmark::DoNotOptimize(ParseAll());
+        fclose(In);
+    }
+    LexFrom(stdin);
+
+    state.SetBytesProcessed(state.iterations() * P.Src.size());
+    state.counters["nodes/s"] = benchmark::Counter(state.iterations() * P.Nodes,
+    benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Parse)->Apply(Shapes);
+
+static void BM_Codegen(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+
+    FILE *In = StartFrontEnd(P.Src);
+    auto Gates = ParseAll();
+    fclose(In);
+    LexFrom(stdin);
+
+    for (auto _ : state) {
+        Signatures.clear();
+        InitializeModule();
+        for (auto &G : Gates) {
+            benchmark::DoNotOptimize(G->codegen());
+        }
+    }
+
+    state.counters["functions/s"] = benchmark::Counter(state.iterations() * Gates.size(),
+    benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Codegen)->Apply(Shapes);
+
+static void BM_Driver(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+    OptLevel = state.range(5);
+    Emit = (EmitMode)state.range(6);
+
+    // The driver talks on stderr a lot; keep it, but out of the terminal
+    fflush(stderr);
+    int SavedErr = dup(2);
+    int Null = open("/dev/null", O_WRONLY);
+    dup2(Null, 2);
+
+    for (auto _ : state) {
+        Signatures.clear();
+        InitializeModule();
+        FILE *In = StartFrontEnd(P.Src);
+        MainLoop();
+        OptimizeModule(*TheModule);
+        if (Emit == emit_echo) {
+            TheModule->print(errs(), nullptr);
+        }
+        fclose(In);
+    }
+    LexFrom(stdin);
+
+    errs().flush();
+    dup2(SavedErr, 2);
+    close(SavedErr);
+    close(Null);
+    OptLevel = 0;
+    Emit = emit_echo;
+
+    state.SetBytesProcessed(state.iterations() * P.Src.size());
+    state.counters["functions/s"] = benchmark::Counter(state.iterations() * P.Gates,
+    benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Driver)
+    ->ArgNames({"gates", "depth", "width", "fanout", "idlen", "O", "emit"})
+    ->Args({100, 3, 3, 2, 8, 0, emit_echo})
+    ->Args({100, 3, 3, 2, 8, 2, emit_echo})
+    ->Args({1000, 3, 3, 2, 8, 0, emit_echo})
+    ->Args({1000, 3, 3, 2, 8, 0, emit_none})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_Pipeline(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+    OptLevel = state.range(5);
+    Emit = (EmitMode)state.range(6);
+
+    fflush(stderr);
+    int SavedErr = dup(2);
+    int Null = open("/dev/null", O_WRONLY);
+    dup2(Null, 2);
+
+    RingStats Tokens, Items;
+    for (auto _ : state) {
+        Signatures.clear();
+        InitializeModule();
+        FILE *In = fmemopen((void *)P.Src.data(), P.Src.size(), "r");
+        LexFrom(In);
+        PipelineLoop();
+        OptimizeModule(*TheModule);
+        if (Emit == emit_echo) {
+            TheModule->print(errs(), nullptr);
+        }
+        fclose(In);
+        Tokens = TokenQueue.Stats;
+        Items = ItemQueue.Stats;
+    }
+    LexFrom(stdin);
+
+    errs().flush();
+    dup2(SavedErr, 2);
+    close(SavedErr);
+    close(Null);
+    OptLevel = 0;
+    Emit = emit_echo;
+
+    state.SetBytesProcessed(state.iterations() * P.Src.size());
+    state.counters["functions/s"] = benchmark::Counter(state.iterations() * P.Gates,
+    benchmark::Counter::kIsRate);
+    state.counters["tokq_depth"] = Tokens.Pushes ? (double)Tokens.DepthSum / Tokens.Pushes : 0;
+    state.counters["itemq_depth"] = Items.Pushes ? (double)Items.DepthSum / Items.Pushes : 0;
+    state.counters["lexer_waits"] = Tokens.FullWaits;
+    state.counters["codegen_waits"] = Items.EmptyWaits;
+}
+BENCHMARK(BM_Pipeline)
+    ->ArgNames({"gates", "depth", "width", "fanout", "idlen", "O", "emit"})
+    ->Args({100, 3, 3, 2, 8, 0, emit_echo})
+    ->Args({100, 3, 3, 2, 8, 2, emit_echo})
+    ->Args({1000, 3, 3, 2, 8, 0, emit_echo})
+    ->Args({1000, 3, 3, 2, 8, 0, emit_none})
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_Dump(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+
+    FILE *In = StartFrontEnd(P.Src);
+    auto Gates = ParseAll();
+    fclose(In);
+    LexFrom(stdin);
+
+    FILE *Null = fopen("/dev/null", "w");
+    for (auto _ : state) {
+        auto D = std::make_unique<ASTDumper>((DumpFormat)state.range(5), Null);
+        for (auto &G : Gates) {
+            D->gate(*G);
+        }
+        D->end();
+    }
+    fclose(Null);
+
+    state.counters["nodes/s"] = benchmark::Counter(state.iterations() * P.Nodes,
+    benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Dump)
+    ->ArgNames({"gates", "depth", "width", "fanout", "idlen", "format"})
+    ->Args({1000, 3, 3, 2, 8, dump_human})
+    ->Args({1000, 3, 3, 2, 8, dump_sexpr})
+    ->Args({1000, 3, 3, 2, 8, dump_json})
+    ->Args({1000, 3, 3, 2, 8, dump_dot})
+    ->Args({100, 6, 3, 2, 8, dump_human});
+
+static void BM_Edit(benchmark::State &state) {
+    ProgramShape Shape;
+    ApplyShape(state, Shape);
+    GeneratedProgram P = GenerateProgram(Shape);
+    Document Doc(P.Src);
+
+    // Just past the name of the gate halfway through
+    size_t Off = P.Src.find(' ', P.Src.find("gate ", P.Src.size() / 2) + 5);
+    size_t LineStart = P.Src.rfind('\n', Off - 1) + 1; // 0 if there's none
+    SourceLocation At = {1 + (int)std::count(P.Src.begin(), P.Src.begin() + Off, '\n'),
+    1 + (int)(Off - LineStart)};
+    SourceLocation After = {At.Line, At.Col + 1};
+
+    size_t Parsed = 0;
+    for (auto _ : state) {
+        Parsed += Doc.edit(At, At, "z");
+        Parsed += Doc.edit(At, After, "");
+    }
+
+    state.counters["edits/s"] = benchmark::Counter(state.iterations() * 2,
+    benchmark::Counter::kIsRate);
+    state.counters["parsed/edit"] = (double)Parsed / (state.iterations() * 2);
+}
+BENCHMARK(BM_Edit)
+    ->ArgNames({"gates", "depth", "width", "fanout", "idlen"})
+    ->Args({100, 3, 3, 2, 8})
+    ->Args({1000, 3, 3, 2, 8})
+    ->Args({10000, 3, 3, 2, 8});
+
+
+int main(int argc, char **argv) {
+    QadinInit(false);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
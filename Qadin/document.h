@@ -0,0 +1,455 @@
+/* Incrementally reparsed source for simple Qadin language, for the language server
+10/18/2026
+Adin Gitig
+
+An editor sends a change per keystroke, and relexing and reparsing a file of thousands
+of gates for each one takes longer than the next keystroke takes to arrive. So a
+Document is kept in chunks: runs of top level items, each owning its text, its tokens
+and what the parser (parsers.h) made of them. A chunk starts at a gate, extern or
+import keyword or just after a ';'. None of those can be part of an expression, so
+no item spans two chunks and each chunk can be parsed on its own. Error recovery
+stops at the end of a chunk too, which only ever makes it recover sooner.
+
+An edit relexes the chunks it touches, and the one before (text typed at the start of
+a chunk can belong to the last item of the one before), and carries on into the ones
+after until a token starts where an old chunk did and starts a chunk again. Only that
+run is split into chunks and parsed again. Every other chunk keeps its tokens and
+ASTs, and so does a relexed chunk whose tokens come out the same, so an edit costs in
+proportion to the items it touches rather than to the file.
+
+For that, nothing in a chunk depends on where it is: token, AST and error lines count
+from the chunk's first line. Its own first line goes stale when lines are added or
+removed above it. Chunks from ShiftFrom on are LineShift lines off, and that's settled
+chunk by chunk as edits move through the file, the way a gap buffer moves its gap,
+rather than for the whole file on every newline.
+
+Lines and columns count from 1, as CurLoc's do.
+*/
+
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace std;
+
+
+struct Chunk {
+    string Text;               // From its first token up to the next chunk's
+    int StartLine, StartCol;   // Where Text starts. StartLine is stale past ShiftFrom
+    int Lines = 0;             // Newlines in Text
+    vector<LexedToken> Tokens; // Lines counted from StartLine, ending in a tok_eof
+    vector<ParsedItem> Items;
+    vector<Diagnostic> Errors; // Lines counted from StartLine
+};
+
+static bool operator==(SourceLocation A, SourceLocation B) {
+    return A.Line == B.Line && A.Col == B.Col;
+}
+
+static bool operator<(SourceLocation A, SourceLocation B) {
+    return A.Line < B.Line || (A.Line == B.Line && A.Col < B.Col);
+}
+
+static bool SameTokens(const vector<LexedToken> &A, const vector<LexedToken> &B) {
+    if (A.size() != B.size()) return false;
+    for (size_t i = 0; i < A.size(); i++) {
+        if (A[i].Kind != B[i].Kind || !(A[i].Loc == B[i].Loc) || A[i].Id != B[i].Id ||
+        (A[i].Kind == tok_num && A[i].Num != B[i].Num)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Where the text after Text starts, if Text starts at column Col of line 1
+static SourceLocation EndOf(const string &Text, int Col) {
+    SourceLocation End = {1, Col};
+    for (char C : Text) {
+        if (C == '\n') {
+            End.Line++;
+            End.Col = 1;
+        } else {
+            End.Col++;
+        }
+    }
+    return End;
+}
+
+// Offset of P in Text, which starts at column Col of line 1. A column past the end
+// of its line means the end of the line, as editors expect
+static size_t OffsetOf(const string &Text, int Col, SourceLocation P) {
+    size_t Offset = 0;
+    for (int Line = 1; Line < P.Line; Line++) {
+        size_t NL = Text.find('\n', Offset);
+        if (NL == string::npos) return Text.size();
+        Offset = NL + 1;
+        Col = 1;
+    }
+    size_t LineEnd = min(Text.find('\n', Offset), Text.size());
+    return min(Offset + max(P.Col - Col, 0), LineEnd);
+}
+
+// Lexes Src, which starts at column Col of line 1, into Out (with no tok_eof)
+static void LexText(const string &Src, int Col, vector<LexedToken> &Out) {
+    if (Src.empty()) return;
+    FILE *In = fmemopen((void *)Src.data(), Src.size(), "r");
+    LexFrom(In);
+    LexLoc = {1, Col - 1};
+    int Kind;
+    while ((Kind = lexer()) != tok_eof) {
+        bool HasId = Kind == tok_id || Kind == tok_type || Kind == tok_str;
+        Out.push_back({Kind, CurLoc, NumVal, HasId ? IdStr : ""});
+    }
+    fclose(In);
+    LexFrom(stdin);
+}
+
+// Whether token i of Toks starts a chunk, given the tokens before it. The first
+// token of all is in the first chunk, which starts at the top of the file
+static bool StartsChunk(const vector<LexedToken> &Toks, size_t i) {
+    int Kind = Toks[i].Kind;
+    return i > 0 && (Kind == tok_gate || Kind == tok_extern || Kind == tok_import ||
+    Toks[i - 1].Kind == ';');
+}
+
+// TokenSource while a chunk is parsed
+static thread_local const LexedToken *ChunkTok;
+
+static int ChunkToken() {
+    const LexedToken &T = *ChunkTok;
+    if (T.Kind != tok_eof) { // The parser may ask for more than one
+        ChunkTok++;
+    }
+    CurLoc = T.Loc;
+    NumVal = T.Num;
+    IdStr = T.Id;
+    return T.Kind;
+}
+
+static void ParseChunk(Chunk &C) {
+    auto *Source = TokenSource;
+    string *Reply = ReplyOut;
+    string Messages; // What LogError prints, which Errors has already
+    TokenSource = ChunkToken;
+    ChunkTok = C.Tokens.data();
+    ReplyOut = &Messages;
+    DiagnosticsOut = &C.Errors;
+
+    getNextTok();
+    while (1) {
+        ParsedItem Item;
+        ParseItem(Item);
+        if (Item.Kind == tok_eof) break;
+        C.Items.push_back(std::move(Item));
+    }
+
+    TokenSource = Source;
+    ReplyOut = Reply;
+    DiagnosticsOut = nullptr;
+}
+
+
+class Document {
+    vector<unique_ptr<Chunk>> Chunks; // Never empty
+    size_t ShiftFrom = 0;
+    int LineShift = 0;
+    unordered_multimap<string, Chunk *> Defs; // Chunks defining each gate and extern
+    unordered_set<Chunk *> Broken;            // Chunks with errors
+
+    int startLine(size_t i) const {
+        return Chunks[i]->StartLine + (i >= ShiftFrom ? LineShift : 0);
+    }
+
+    // Makes every StartLine before chunk K exact, and moves ShiftFrom to K
+    void settle(size_t K) {
+        while (ShiftFrom < K) Chunks[ShiftFrom++]->StartLine += LineShift;
+        while (ShiftFrom > K) Chunks[--ShiftFrom]->StartLine -= LineShift;
+    }
+
+    // The chunk P is in: the last to start at or before it
+    size_t chunkAt(SourceLocation P) const {
+        size_t Lo = 0, Hi = Chunks.size();
+        while (Hi - Lo > 1) {
+            size_t Mid = (Lo + Hi) / 2;
+            if (P < SourceLocation{startLine(Mid), Chunks[Mid]->StartCol}) {
+                Hi = Mid;
+            } else {
+                Lo = Mid;
+            }
+        }
+        return Lo;
+    }
+
+    // Where C is in Chunks. Both sides of ShiftFrom are in order of their StartLines
+    // as they are stored, so each can be searched
+    size_t indexOf(const Chunk *C) const {
+        SourceLocation Key = {C->StartLine, C->StartCol};
+        auto Less = [](const unique_ptr<Chunk> &X, SourceLocation K) {
+            return SourceLocation{X->StartLine, X->StartCol} < K;
+        };
+        auto Split = Chunks.begin() + ShiftFrom;
+        auto It = lower_bound(Chunks.begin(), Split, Key, Less);
+        if (It == Split || It->get() != C) {
+            It = lower_bound(Split, Chunks.end(), Key, Less);
+        }
+        return It - Chunks.begin();
+    }
+
+    void track(Chunk *C) {
+        for (auto &Item : C->Items) {
+            if (Item.Kind == tok_gate) Defs.emplace(Item.Fn->getName(), C);
+            if (Item.Kind == tok_extern) Defs.emplace(Item.Proto->getName(), C);
+        }
+        if (!C->Errors.empty()) Broken.insert(C);
+    }
+
+    void untrack(Chunk *C) {
+        for (auto &Item : C->Items) {
+            const string *Name = Item.Kind == tok_gate ? &Item.Fn->getName() :
+            Item.Kind == tok_extern ? &Item.Proto->getName() : nullptr;
+            if (!Name) continue;
+            auto Range = Defs.equal_range(*Name);
+            for (auto It = Range.first; It != Range.second; ++It) {
+                if (It->second == C) {
+                    Defs.erase(It);
+                    break;
+                }
+            }
+        }
+        Broken.erase(C);
+    }
+
+    // Splits Toks, lexed from Src (which starts at Line, Col), into chunks
+    static vector<unique_ptr<Chunk>> split(const string &Src, int Line, int Col,
+    vector<LexedToken> &Toks) {
+        vector<size_t> LineStarts = {0};
+        for (size_t i = 0; i < Src.size(); i++) {
+            if (Src[i] == '\n') LineStarts.push_back(i + 1);
+        }
+        auto Offset = [&](SourceLocation L) {
+            return LineStarts[L.Line - 1] + L.Col - (L.Line == 1 ? Col : 1);
+        };
+
+        vector<unique_ptr<Chunk>> Out;
+        size_t First = 0; // Token the chunk being built starts at
+        while (1) {
+            size_t Next = First + 1;
+            while (Next < Toks.size() && !StartsChunk(Toks, Next)) Next++;
+
+            auto C = make_unique<Chunk>();
+            SourceLocation Start = Out.empty() ? SourceLocation{1, Col} : Toks[First].Loc;
+            size_t Begin = Out.empty() ? 0 : Offset(Start);
+            size_t End = Next < Toks.size() ? Offset(Toks[Next].Loc) : Src.size();
+            C->Text = Src.substr(Begin, End - Begin);
+            C->StartLine = Line + Start.Line - 1;
+            C->StartCol = Start.Col;
+            C->Lines = count(C->Text.begin(), C->Text.end(), '\n');
+            for (size_t i = First; i < min(Next, Toks.size()); i++) {
+                C->Tokens.push_back(std::move(Toks[i]));
+                C->Tokens.back().Loc.Line -= Start.Line - 1;
+            }
+            C->Tokens.push_back({tok_eof, EndOf(C->Text, C->StartCol), 0, ""});
+            Out.push_back(std::move(C));
+
+            if (Next >= Toks.size()) return Out;
+            First = Next;
+        }
+    }
+
+    public:
+        Document(const string &Text = "") {open(Text);}
+
+        // Replaces the whole text
+        void open(const string &Text) {
+            Chunks.clear();
+            Defs.clear();
+            Broken.clear();
+            ShiftFrom = 0;
+            LineShift = 0;
+            vector<LexedToken> Toks;
+            LexText(Text, 1, Toks);
+            Chunks = split(Text, 1, 1, Toks);
+            for (auto &C : Chunks) {
+                ParseChunk(*C);
+                track(C.get());
+            }
+        }
+
+        // Replaces the text from From up to To with NewText. Returns how many chunks
+        // had to be parsed again
+        size_t edit(SourceLocation From, SourceLocation To, const string &NewText) {
+            if (To < From) swap(From, To);
+            size_t First = chunkAt(From), Last = chunkAt(To);
+
+            // The text of the chunks the edit touches, with the edit made
+            string Src;
+            size_t FromOff = 0, ToOff = 0;
+            for (size_t i = First; i <= Last; i++) {
+                const Chunk &C = *Chunks[i];
+                SourceLocation Start = {startLine(i), C.StartCol};
+                if (i == First) {
+                    FromOff = Src.size() + OffsetOf(C.Text, C.StartCol, {From.Line - Start.Line + 1,
+                    From.Col});
+                }
+                if (i == Last) {
+                    ToOff = Src.size() + OffsetOf(C.Text, C.StartCol, {To.Line - Start.Line + 1,
+                    To.Col});
+                }
+                Src += C.Text;
+            }
+            Src.replace(FromOff, ToOff - FromOff, NewText);
+            if (First > 0) {
+                First--;
+                Src.insert(0, Chunks[First]->Text);
+            }
+            int Line = startLine(First), Col = Chunks[First]->StartCol;
+
+            // Take in the chunks after until one can be kept as it is: it starts on a
+            // token in the same column, which still starts a chunk. Lexing from there
+            // on gives the tokens it already has
+            size_t End = Last + 1; // First chunk kept after the edit
+            vector<LexedToken> Toks;
+            while (1) {
+                Toks.clear();
+                if (End == Chunks.size()) {
+                    LexText(Src, Col, Toks);
+                    break;
+                }
+                SourceLocation Boundary = EndOf(Src, Col);
+                string More = Src + Chunks[End]->Text;
+                LexText(More, Col, Toks);
+                size_t i = 0;
+                while (i < Toks.size() && Toks[i].Loc < Boundary) i++;
+                if (i < Toks.size() && Toks[i].Loc == Boundary &&
+                Boundary.Col == Chunks[End]->StartCol && StartsChunk(Toks, i)) {
+                    Toks.resize(i);
+                    break;
+                }
+                Src = std::move(More);
+                End++;
+            }
+
+            // Only chunks whose tokens changed are parsed. Unchanged ones are matched
+            // from the front and from the back of the run, and keep their ASTs
+            auto New = split(Src, Line, Col, Toks);
+            size_t Old = End - First, Parsed = 0;
+            int OldLines = 0, NewLines = 0;
+            settle(End);
+            for (size_t k = First; k < End; k++) {
+                OldLines += Chunks[k]->Lines;
+                untrack(Chunks[k].get());
+            }
+            vector<bool> Kept(Old, false);
+            for (size_t j = 0; j < New.size(); j++) {
+                size_t Back = New.size() - 1 - j;
+                size_t k = Old; // The old chunk it's the same as, if any
+                if (j < Old && !Kept[j] && SameTokens(New[j]->Tokens, Chunks[First + j]->Tokens)) {
+                    k = j;
+                } else if (Back < Old && !Kept[Old - 1 - Back] &&
+                SameTokens(New[j]->Tokens, Chunks[End - 1 - Back]->Tokens)) {
+                    k = Old - 1 - Back;
+                }
+                if (k < Old) {
+                    Kept[k] = true;
+                    unique_ptr<Chunk> &C = Chunks[First + k];
+                    C->Text = std::move(New[j]->Text);
+                    C->StartLine = New[j]->StartLine;
+                    C->StartCol = New[j]->StartCol;
+                    C->Lines = New[j]->Lines;
+                    New[j] = std::move(C);
+                } else {
+                    ParseChunk(*New[j]);
+                    Parsed++;
+                }
+                NewLines += New[j]->Lines;
+            }
+
+            Chunks.erase(Chunks.begin() + First, Chunks.begin() + End);
+            Chunks.insert(Chunks.begin() + First, make_move_iterator(New.begin()),
+            make_move_iterator(New.end()));
+            ShiftFrom = First + New.size();
+            LineShift += NewLines - OldLines;
+            for (size_t k = First; k < ShiftFrom; k++) {
+                track(Chunks[k].get());
+            }
+            return Parsed;
+        }
+
+        // Errors anywhere in the document, in order
+        vector<Diagnostic> diagnostics() const {
+            vector<Diagnostic> Out;
+            for (const Chunk *C : Broken) {
+                int Line = startLine(indexOf(C));
+                for (const Diagnostic &D : C->Errors) {
+                    Out.push_back({{Line + D.Loc.Line - 1, D.Loc.Col}, D.Message});
+                }
+            }
+            std::sort(Out.begin(), Out.end(), [](const Diagnostic &A, const Diagnostic &B) {
+                return A.Loc < B.Loc;
+            });
+            return Out;
+        }
+
+        // Where the gate called at P is defined: the name of each gate and extern by
+        // that name. Empty unless P is on the callee of a call
+        vector<SourceLocation> definition(SourceLocation P) const {
+            vector<SourceLocation> Out;
+            size_t i = chunkAt(P);
+            const Chunk &C = *Chunks[i];
+            SourceLocation Rel = {P.Line - startLine(i) + 1, P.Col};
+
+            // The identifier P is on
+            auto It = upper_bound(C.Tokens.begin(), C.Tokens.end(), Rel,
+            [](SourceLocation L, const LexedToken &T) {return L < T.Loc;});
+            if (It == C.Tokens.begin()) return Out;
+            const LexedToken &T = *--It;
+            if (T.Kind != tok_id || T.Loc.Line != Rel.Line ||
+            Rel.Col >= T.Loc.Col + (int)T.Id.size()) {
+                return Out;
+            }
+
+            // Whether it's a callee: a CallExprAST starts on it. The chunk's trees are
+            // flattened to look, which is cheap for the few items a chunk holds
+            ASTWriter W;
+            for (auto &Item : C.Items) {
+                if (Item.Fn) W.addGate(*Item.Fn);
+            }
+            bool Callee = false;
+            for (const ASTNode &N : W.nodes()) {
+                if (N.Kind == node_call && (int)N.Line == T.Loc.Line && (int)N.Col == T.Loc.Col) {
+                    Callee = true;
+                    break;
+                }
+            }
+            if (!Callee) return Out;
+
+            vector<const Chunk *> Seen;
+            auto Range = Defs.equal_range(T.Id);
+            for (auto D = Range.first; D != Range.second; ++D) {
+                const Chunk *Def = D->second;
+                if (find(Seen.begin(), Seen.end(), Def) != Seen.end()) continue;
+                Seen.push_back(Def);
+                int Line = startLine(indexOf(Def));
+                // The name after each gate or extern keyword
+                for (size_t k = 0; k + 1 < Def->Tokens.size(); k++) {
+                    const LexedToken &Kw = Def->Tokens[k], &Name = Def->Tokens[k + 1];
+                    if ((Kw.Kind == tok_gate || Kw.Kind == tok_extern) && Name.Kind == tok_id &&
+                    Name.Id == T.Id) {
+                        Out.push_back({Line + Name.Loc.Line - 1, Name.Loc.Col});
+                    }
+                }
+            }
+            std::sort(Out.begin(), Out.end());
+            return Out;
+        }
+
+        // The whole text. Takes time in proportion to it, unlike everything else
+        string text() const {
+            string Out;
+            for (auto &C : Chunks) {
+                Out += C->Text;
+            }
+            return Out;
+        }
+
+        size_t chunks() const {return Chunks.size();}
+};
@@ -18,24 +18,72 @@ enum Token {
     // Term
     tok_id = -4,
     tok_num = -5,
+
+    // Control flow
+    tok_if = -6,
+    tok_then = -7,
+    tok_else = -8,
+    tok_for = -9,
+    tok_in = -10,
+
+    // Types, IdStr holds which one
+    tok_type = -11,
+
+    // Libraries. A string's contents are in IdStr
+    tok_import = -12,
+    tok_str = -13,
 };
 
-static string IdStr; // Global, metadata for tok_id
-static double NumVal; // Global, metadata for tok_num
+// Global, metadata for tok_id, tok_str and tok_num. Per thread, because with
+// --pipeline the lexer runs on one thread and the parser reads them on another
+static thread_local string IdStr;
+static thread_local double NumVal;
+
+// The lexer's own state is per thread too, so that the compile server's workers can
+// each lex a request of their own
+static thread_local FILE *LexIn = stdin; // Where lexer() reads from
+static thread_local int LastChar = ' '; // Lookahead character, read but not yet lexed
+
+// Lines and columns both count from 1, 0 means unknown
+struct SourceLocation {
+    int Line;
+    int Col;
+};
+static thread_local SourceLocation CurLoc; // Where the token lexer() last returned starts
+static thread_local SourceLocation LexLoc = {1, 0}; // Where LastChar is
+
+// Points the lexer at a new input, dropping whatever was left of the old one
+static void LexFrom(FILE *In) {
+    LexIn = In;
+    LastChar = ' ';
+    LexLoc = {1, 0};
+}
+
+// Next character of the input, keeping LexLoc up to date
+static int advance() {
+    int C = getc(LexIn);
+    if (C == '\n') {
+        LexLoc.Line++;
+        LexLoc.Col = 0;
+    } else {
+        LexLoc.Col++;
+    }
+    return C;
+}
 
 // Lexer, or gettok() function
 static int lexer() {
-    static int LastChar = ' ';
 
     while (isspace(LastChar)) { // Loop to skip whitespace btwn tok's
-        LastChar = getchar();
+        LastChar = advance();
     }
+    CurLoc = LexLoc;
 
     if (isalpha(LastChar)) { // Loop to get identifiers (must begin with a letter)
         
         /* Build out IdStr */
         IdStr = LastChar;
-        while (isalnum((LastChar = getchar()))) {
+        while (isalnum((LastChar = advance()))) {
             IdStr += LastChar;
         }
 
@@ -44,6 +92,20 @@ static int lexer() {
             return tok_gate;
         } else if (IdStr == "extern") {
             return tok_extern;
+        } else if (IdStr == "if") {
+            return tok_if;
+        } else if (IdStr == "then") {
+            return tok_then;
+        } else if (IdStr == "else") {
+            return tok_else;
+        } else if (IdStr == "for") {
+            return tok_for;
+        } else if (IdStr == "in") {
+            return tok_in;
+        } else if (IdStr == "import") {
+            return tok_import;
+        } else if (IdStr == "vec2" || IdStr == "vec4" || IdStr == "vec8" || IdStr == "buf") {
+            return tok_type;
         } else {
             return tok_id; // Is some variable identifier
         }
@@ -55,16 +117,27 @@ static int lexer() {
         do {
             NumStr += LastChar;
             one_dec = one_dec || (LastChar == '.');
-            LastChar = getchar();
+            LastChar = advance();
         } while (isdigit(LastChar) || (LastChar == '.' && !one_dec));
 
         NumVal = strtod(NumStr.c_str(), 0);
         return tok_num;
 
+    } else if (LastChar == '"') { // Strings, which can't span lines or escape a quote
+
+        IdStr.clear();
+        while ((LastChar = advance()) != '"' && LastChar != EOF && LastChar != '\n') {
+            IdStr += LastChar;
+        }
+        if (LastChar == '"') {
+            LastChar = advance();
+        }
+        return tok_str;
+
     } else if (LastChar == '#') { // Comments
 
         do {
-            LastChar = getchar();
+            LastChar = advance();
         } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
 
         if (LastChar != EOF) {
@@ -77,7 +150,7 @@ static int lexer() {
         return tok_eof;
     } else { // Some ASCII character like ';', '+' etc., which we treat as its own tok
         int ThisChar = LastChar;
-        LastChar = getchar();
+        LastChar = advance();
         return ThisChar; // Some tok identifier 0 <= tok <= 255, its ASCII value
     }
 }
\ No newline at end of file
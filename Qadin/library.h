@@ -0,0 +1,240 @@
+/* Precompiled gate libraries for simple Qadin language, --emit=qlib and import
+10/18/2026
+Adin Gitig
+Sources: http://www.isthe.com/chongo/tech/comp/fnv/
+
+A library is a set of gates compiled ahead of time, each to bitcode of its own, plus
+a hash index of their signatures. import "lib.qlib" maps the file in and nothing
+more. A gate's signature is only looked up when the program calls a name it doesn't
+define, and its bitcode is only read and linked in once a module that calls it is
+finished (LinkImports), along with whatever it calls in turn. So a program using 3
+gates of a 1000 gate prelude pays for those 3, not for recompiling the prelude.
+
+Layout, in the host's byte order:
+  QLibHeader
+  buckets  uint32_t[NumBuckets]    first entry of each hash chain, or NoEntry
+  entries  QLibEntry[NumEntries]
+  strings  char[StrBytes]          names and argument types, each ending in a NUL
+  bitcode                          a complete bitcode file per gate, back to back
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+
+static const char QLibMagic[4] = {'Q', 'L', 'I', 'B'};
+static const uint32_t QLibVersion = 1 | ('L' << 24); // L: written little endian
+static const uint32_t NoEntry = UINT32_MAX;
+
+struct QLibHeader {
+    char Magic[4];
+    uint32_t Version;
+    uint32_t NumBuckets, NumEntries, StrBytes, Reserved;
+    uint64_t Buckets, Entries, Strings, Bitcode; // Offsets from the start
+};
+
+struct QLibEntry {
+    uint32_t Hash;
+    uint32_t Next; // In the same bucket, or NoEntry
+    uint32_t Name;
+    uint32_t ArgTypes, NumArgs; // A QType per byte
+    uint32_t RetType;
+    uint64_t Bitcode, BitcodeSize; // Offset from the start of the file
+};
+
+// 32 bit FNV-1a
+static uint32_t HashName(llvm::StringRef Name) {
+    uint32_t H = 2166136261u;
+    for (char C : Name) {
+        H = (H ^ (unsigned char)C) * 16777619u;
+    }
+    return H;
+}
+
+
+class LibraryWriter {
+    vector<QLibEntry> Entries;
+    string Strings;
+    string Bitcode;
+
+    uint32_t str(llvm::StringRef S) {
+        uint32_t Offset = Strings.size();
+        Strings.append(S.data(), S.size());
+        Strings += '\0';
+        return Offset;
+    }
+
+    public:
+        // Adds a gate. ArgTypes has a QType per char, as in a Signature
+        void add(llvm::StringRef Name, QType RetType, llvm::StringRef ArgTypes,
+        llvm::StringRef Code) {
+            QLibEntry E = {};
+            E.Hash = HashName(Name);
+            E.Name = str(Name);
+            E.ArgTypes = str(ArgTypes);
+            E.NumArgs = ArgTypes.size();
+            E.RetType = RetType;
+            E.Bitcode = Bitcode.size(); // Relative until write() knows where bitcode starts
+            E.BitcodeSize = Code.size();
+            Bitcode.append(Code.data(), Code.size());
+            Entries.push_back(E);
+        }
+
+        bool write(const char *Path) {
+            // About one entry per bucket keeps chains short without wasting much
+            uint32_t NumBuckets = 1;
+            while (NumBuckets < Entries.size()) NumBuckets *= 2;
+            vector<uint32_t> Buckets(NumBuckets, NoEntry);
+
+            QLibHeader H = {};
+            memcpy(H.Magic, QLibMagic, 4);
+            H.Version = QLibVersion;
+            H.NumBuckets = NumBuckets;
+            H.NumEntries = Entries.size();
+            H.StrBytes = Strings.size();
+
+            auto Align = [](uint64_t Off) {return (Off + 7) & ~(uint64_t)7;};
+            H.Buckets = Align(sizeof(H));
+            H.Entries = Align(H.Buckets + NumBuckets * sizeof(uint32_t));
+            H.Strings = Align(H.Entries + Entries.size() * sizeof(QLibEntry));
+            H.Bitcode = Align(H.Strings + Strings.size());
+
+            // Later entries go on the front of their chain, so walk backwards to keep
+            // the first definition of a name the one that's found
+            for (size_t i = Entries.size(); i-- > 0;) {
+                QLibEntry &E = Entries[i];
+                uint32_t &Head = Buckets[E.Hash & (NumBuckets - 1)];
+                E.Next = Head;
+                Head = i;
+                E.Bitcode += H.Bitcode;
+            }
+
+            FILE *Out = fopen(Path, "wb");
+            if (!Out) {
+                perror(Path);
+                return false;
+            }
+            bool Ok = fwrite(&H, sizeof(H), 1, Out) == 1 && !fseek(Out, H.Buckets, SEEK_SET) &&
+            fwrite(Buckets.data(), sizeof(uint32_t), NumBuckets, Out) == NumBuckets &&
+            !fseek(Out, H.Entries, SEEK_SET) &&
+            fwrite(Entries.data(), sizeof(QLibEntry), Entries.size(), Out) == Entries.size() &&
+            !fseek(Out, H.Strings, SEEK_SET) &&
+            fwrite(Strings.data(), 1, Strings.size(), Out) == Strings.size() &&
+            !fseek(Out, H.Bitcode, SEEK_SET) &&
+            fwrite(Bitcode.data(), 1, Bitcode.size(), Out) == Bitcode.size();
+            if (fclose(Out) || !Ok) {
+                perror(Path);
+                return false;
+            }
+            return true;
+        }
+};
+
+
+// An imported library, mapped into memory. Only the pages a lookup or a gate's
+// bitcode touch are ever read
+class Library {
+    string Path;
+    void *Map = MAP_FAILED;
+    size_t Size = 0;
+    const QLibHeader *H = nullptr;
+    const uint32_t *Buckets;
+    const QLibEntry *Entries;
+    const char *Strings;
+
+    // Whether Count records of Size bytes at Offset fit in the file
+    bool fits(uint64_t Offset, uint64_t Count, uint64_t Size) const {
+        return Offset % 8 == 0 && Offset <= this->Size && Count <= (this->Size - Offset) / Size;
+    }
+
+    static bool validType(uint32_t Type) {
+        return Type == ty_buf || Type == ty_double || Type == ty_vec2 || Type == ty_vec4 ||
+        Type == ty_vec8;
+    }
+
+    // Whether E's strings and bitcode are all inside the file, and its types are types
+    bool valid(const QLibEntry &E) const {
+        if (!(E.Name < H->StrBytes && E.ArgTypes <= H->StrBytes &&
+        E.NumArgs <= H->StrBytes - E.ArgTypes && E.Bitcode <= Size &&
+        E.BitcodeSize <= Size - E.Bitcode && memchr(Strings + E.Name, 0, H->StrBytes - E.Name) &&
+        validType(E.RetType))) {
+            return false;
+        }
+        for (uint32_t i = 0; i < E.NumArgs; i++) {
+            if (!validType((unsigned char)Strings[E.ArgTypes + i])) return false;
+        }
+        return true;
+    }
+
+    public:
+        Library(const string &Path) : Path(Path) {}
+        ~Library() {
+            if (Map != MAP_FAILED) munmap(Map, Size);
+        }
+
+        const string &path() const {return Path;}
+
+        static unique_ptr<Library> open(const string &Path) {
+            int FD = ::open(Path.c_str(), O_RDONLY);
+            if (FD < 0) {
+                LogError((Path + ": " + strerror(errno)).c_str());
+                return nullptr;
+            }
+            struct stat St;
+            auto L = make_unique<Library>(Path);
+            if (fstat(FD, &St) == 0 && St.st_size >= (off_t)sizeof(QLibHeader)) {
+                L->Size = St.st_size;
+                L->Map = mmap(nullptr, L->Size, PROT_READ, MAP_PRIVATE, FD, 0);
+            }
+            close(FD);
+            if (L->Map == MAP_FAILED) {
+                LogError((Path + ": not a gate library").c_str());
+                return nullptr;
+            }
+
+            const char *Base = (const char *)L->Map;
+            L->H = (const QLibHeader *)Base;
+            const QLibHeader &H = *L->H;
+            if (memcmp(H.Magic, QLibMagic, 4) || H.Version != QLibVersion) {
+                LogError((Path + ": not a gate library, or from another version").c_str());
+                return nullptr;
+            }
+            if (!H.NumBuckets || (H.NumBuckets & (H.NumBuckets - 1)) ||
+            !L->fits(H.Buckets, H.NumBuckets, sizeof(uint32_t)) ||
+            !L->fits(H.Entries, H.NumEntries, sizeof(QLibEntry)) || !L->fits(H.Strings, H.StrBytes, 1)) {
+                LogError((Path + ": truncated gate library").c_str());
+                return nullptr;
+            }
+            L->Buckets = (const uint32_t *)(Base + H.Buckets);
+            L->Entries = (const QLibEntry *)(Base + H.Entries);
+            L->Strings = Base + H.Strings;
+            return L;
+        }
+
+        // The gate called Name, or nullptr if there isn't one (or its entry is broken)
+        const QLibEntry *find(llvm::StringRef Name) const {
+            uint32_t Hash = HashName(Name);
+            uint32_t i = Buckets[Hash & (H->NumBuckets - 1)];
+            for (uint32_t Steps = 0; i < H->NumEntries && Steps < H->NumEntries; Steps++) {
+                const QLibEntry &E = Entries[i];
+                if (E.Hash == Hash && valid(E) && Name == Strings + E.Name) {
+                    return &E;
+                }
+                i = E.Next;
+            }
+            return nullptr;
+        }
+
+        llvm::StringRef argTypes(const QLibEntry &E) const {
+            return llvm::StringRef(Strings + E.ArgTypes, E.NumArgs);
+        }
+
+        llvm::StringRef bitcode(const QLibEntry &E) const {
+            return llvm::StringRef((const char *)Map + E.Bitcode, E.BitcodeSize);
+        }
+};
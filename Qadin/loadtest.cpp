@@ -0,0 +1,201 @@
+/* Load tester for the simple Qadin language compile server
+10/18/2026
+Adin Gitig
+
+Opens --clients sessions with a server started by Qadin_driver --serve=<socket>, and
+has each send --requests requests, one after another, timing every one. Each session
+first sends --setup (once, untimed) to define the gates the timed requests use. Run
+  ./Qadin_loadtest --socket=/tmp/qadin.sock --clients=8 --requests=1000
+and it prints throughput and the latency percentiles over every request.
+
+--verb=compile sends the setup source itself as each request instead, for objects.
+--setup and --source read files; by default the setup defines a couple of gates and
+each request evaluates an expression calling them.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "server.h"
+
+using namespace std;
+
+
+// A connection to the server at Path. -1 on failure
+static int ConnectTo(const char *Path) {
+    sockaddr_un Addr;
+    if (!SocketAddress(Path, Addr)) return -1;
+    int FD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(FD, (sockaddr *)&Addr, sizeof(Addr))) {
+        perror(Path);
+        close(FD);
+        return -1;
+    }
+    return FD;
+}
+
+struct LoadOptions {
+    const char *Socket = "/tmp/qadin.sock";
+    int Clients = 4;
+    int Requests = 200;
+    string Verb = "eval";
+    string Setup = "gate sq(x) x * x;\ngate hyp(x y) sq(x) + sq(y);\n";
+    string Source = "hyp(3, 4);\n";
+};
+
+struct ClientResult {
+    vector<double> LatenciesUs;
+    int Errors = 0;
+    bool Connected = false;
+};
+
+static double NowUs() {
+    return chrono::duration<double, micro>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void RunClient(const LoadOptions &Opts, ClientResult &R) {
+    int FD = ConnectTo(Opts.Socket);
+    if (FD < 0) return;
+    R.Connected = true;
+    MessageReader In(FD);
+    string Status, Reply;
+
+    bool Compile = Opts.Verb == "compile";
+    if (!Compile) {
+        if (!SendMessage(FD, "eval", Opts.Setup) || !In.read(Status, Reply)) {
+            close(FD);
+            return;
+        }
+        if (Status != "ok") {
+            fprintf(stderr, "Setup failed: %s", Reply.c_str());
+            R.Errors++;
+        }
+    }
+
+    const string &Body = Compile ? Opts.Setup : Opts.Source;
+    R.LatenciesUs.reserve(Opts.Requests);
+    for (int i = 0; i < Opts.Requests; i++) {
+        double Start = NowUs();
+        if (!SendMessage(FD, Opts.Verb, Body) || !In.read(Status, Reply)) {
+            fprintf(stderr, "Lost the connection\n");
+            R.Errors++;
+            break;
+        }
+        R.LatenciesUs.push_back(NowUs() - Start);
+        if (Status != "ok") {
+            if (!R.Errors) fprintf(stderr, "Request failed: %s", Reply.c_str());
+            R.Errors++;
+        }
+    }
+    close(FD);
+}
+
+// The value P% of Sorted are at or below
+static double Percentile(const vector<double> &Sorted, double P) {
+    if (Sorted.empty()) return 0;
+    size_t Rank = (size_t)(P / 100 * (Sorted.size() - 1) + 0.5);
+    return Sorted[min(Rank, Sorted.size() - 1)];
+}
+
+static bool ReadFile(const char *Path, string &Out) {
+    ifstream F(Path);
+    if (!F) {
+        perror(Path);
+        return false;
+    }
+    stringstream SS;
+    SS << F.rdbuf();
+    Out = SS.str();
+    return true;
+}
+
+int main(int argc, char **argv) {
+    LoadOptions Opts;
+    static struct option long_opts[] = {
+        {"socket", required_argument, nullptr, 's'},
+        {"clients", required_argument, nullptr, 'c'},
+        {"requests", required_argument, nullptr, 'n'},
+        {"verb", required_argument, nullptr, 'v'},
+        {"setup", required_argument, nullptr, 'S'},
+        {"source", required_argument, nullptr, 'f'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, nullptr)) != -1) {
+        switch (opt) {
+            case 's':
+                Opts.Socket = optarg;
+                break;
+            case 'c':
+                Opts.Clients = max(1, atoi(optarg));
+                break;
+            case 'n':
+                Opts.Requests = max(1, atoi(optarg));
+                break;
+            case 'v':
+                Opts.Verb = optarg;
+                if (Opts.Verb != "eval" && Opts.Verb != "compile") {
+                    fprintf(stderr, "--verb is eval or compile\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                if (!ReadFile(optarg, Opts.Setup)) return 1;
+                break;
+            case 'f':
+                if (!ReadFile(optarg, Opts.Source)) return 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--socket=<path>] [--clients=N] [--requests=N]\n"
+                "  [--verb=eval|compile] [--setup=<file>] [--source=<file>]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    vector<ClientResult> Results(Opts.Clients);
+    vector<thread> Clients;
+    double Start = NowUs();
+    for (int i = 0; i < Opts.Clients; i++) {
+        Clients.emplace_back(RunClient, cref(Opts), ref(Results[i]));
+    }
+    for (auto &C : Clients) {
+        C.join();
+    }
+    double Elapsed = NowUs() - Start;
+
+    vector<double> All;
+    int Errors = 0, Connected = 0;
+    for (auto &R : Results) {
+        All.insert(All.end(), R.LatenciesUs.begin(), R.LatenciesUs.end());
+        Errors += R.Errors;
+        Connected += R.Connected;
+    }
+    if (!Connected) {
+        return 1;
+    }
+    sort(All.begin(), All.end());
+    double Sum = 0;
+    for (double L : All) Sum += L;
+
+    printf("%d clients x %d %s requests: %zu done, %d failed, in %.3f s (%.0f requests/s)\n",
+    Opts.Clients, Opts.Requests, Opts.Verb.c_str(), All.size(), Errors, Elapsed / 1e6,
+    All.size() / (Elapsed / 1e6));
+    printf("latency (us): mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+    All.empty() ? 0 : Sum / All.size(), Percentile(All, 50), Percentile(All, 90),
+    Percentile(All, 99), All.empty() ? 0 : All.back());
+    return Errors ? 1 : 0;
+}
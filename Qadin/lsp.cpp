@@ -0,0 +1,196 @@
+/* Language server for simple Qadin language
+10/18/2026
+Adin Gitig
+Sources: https://microsoft.github.io/language-server-protocol/specifications/lsp/3.17/specification/
+
+Speaks the Language Server Protocol on stdin and stdout, so an editor gets errors as
+they're typed and can go to the definition of a called gate. Each open file is a
+Document (document.h), synced incrementally, so a change only relexes and reparses
+the items it touches. With --log, how long each change took and how many chunks it
+parsed again go to stderr.
+
+Handles initialize, shutdown, exit, textDocument/didOpen, didChange, didClose and
+definition. Other requests get MethodNotFound, other notifications are ignored.
+Columns are taken to be bytes, which for Qadin's ASCII source is the same as the
+protocol's UTF-16 units.
+*/
+
+#include "llvm/Support/JSON.h"
+
+#define QADIN_NO_MAIN
+#include "Qadin.cpp"
+#include "document.h"
+
+static bool LogEdits = false;
+static std::map<std::string, Document> Documents; // By URI
+
+
+// A message's content, once its headers have been read. False at the end of the input
+static bool ReadMessage(std::string &Content) {
+    size_t Length = 0;
+    bool HaveLength = false;
+    char Line[256];
+    while (fgets(Line, sizeof(Line), stdin)) {
+        if (!strcmp(Line, "\r\n") || !strcmp(Line, "\n")) {
+            if (!HaveLength) continue;
+            Content.resize(Length);
+            return fread(&Content[0], 1, Length, stdin) == Length;
+        }
+        if (!strncasecmp(Line, "Content-Length:", 15)) {
+            Length = strtoull(Line + 15, nullptr, 10);
+            HaveLength = true;
+        }
+    }
+    return false;
+}
+
+static void Send(const json::Value &Msg) {
+    std::string Out;
+    raw_string_ostream OS(Out);
+    OS << Msg;
+    OS.flush();
+    printf("Content-Length: %zu\r\n\r\n%s", Out.size(), Out.c_str());
+    fflush(stdout);
+}
+
+static void Reply(const json::Value &Id, json::Value Result) {
+    Send(json::Object{{"jsonrpc", "2.0"}, {"id", Id}, {"result", std::move(Result)}});
+}
+
+static void ReplyError(const json::Value &Id, int Code, StringRef Message) {
+    Send(json::Object{{"jsonrpc", "2.0"}, {"id", Id},
+    {"error", json::Object{{"code", Code}, {"message", Message}}}});
+}
+
+// The protocol counts from 0, SourceLocation from 1
+static bool GetPosition(const json::Object *Pos, SourceLocation &P) {
+    auto Line = Pos ? Pos->getInteger("line") : None;
+    auto Col = Pos ? Pos->getInteger("character") : None;
+    if (!Line || !Col) return false;
+    P = {(int)*Line + 1, (int)*Col + 1};
+    return true;
+}
+
+static json::Object Position(SourceLocation P) {
+    return json::Object{{"line", P.Line - 1}, {"character", P.Col - 1}};
+}
+
+static void PublishDiagnostics(const std::string &URI, const Document &Doc) {
+    json::Array Diags;
+    for (const Diagnostic &D : Doc.diagnostics()) {
+        Diags.push_back(json::Object{
+            {"range", json::Object{{"start", Position(D.Loc)},
+            {"end", Position({D.Loc.Line, D.Loc.Col + 1})}}},
+            {"severity", 1},
+            {"source", "qadin"},
+            {"message", D.Message}});
+    }
+    Send(json::Object{{"jsonrpc", "2.0"}, {"method", "textDocument/publishDiagnostics"},
+    {"params", json::Object{{"uri", URI}, {"diagnostics", std::move(Diags)}}}});
+}
+
+static void DidChange(const std::string &URI, const json::Array &Changes) {
+    auto It = Documents.find(URI);
+    if (It == Documents.end()) return;
+    Document &Doc = It->second;
+
+    for (const json::Value &V : Changes) {
+        const json::Object *Change = V.getAsObject();
+        auto Text = Change ? Change->getString("text") : None;
+        if (!Text) continue;
+        double Start = WallNow();
+        size_t Parsed;
+        if (const json::Object *Range = Change->getObject("range")) {
+            SourceLocation From, To;
+            if (!GetPosition(Range->getObject("start"), From) ||
+            !GetPosition(Range->getObject("end"), To)) {
+                continue;
+            }
+            Parsed = Doc.edit(From, To, Text->str());
+        } else {
+            Doc.open(Text->str());
+            Parsed = Doc.chunks();
+        }
+        if (LogEdits) {
+            fprintf(stderr, "change: %zu of %zu chunks parsed in %.1f us\n", Parsed, Doc.chunks(),
+            (WallNow() - Start) / 1e3);
+        }
+    }
+    PublishDiagnostics(URI, Doc);
+}
+
+static json::Value Definition(const std::string &URI, SourceLocation P) {
+    json::Array Locations;
+    auto It = Documents.find(URI);
+    if (It == Documents.end()) return Locations;
+    for (SourceLocation L : It->second.definition(P)) {
+        Locations.push_back(json::Object{{"uri", URI},
+        {"range", json::Object{{"start", Position(L)}, {"end", Position(L)}}}});
+    }
+    return Locations;
+}
+
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--log")) {
+            LogEdits = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--log]\n", argv[0]);
+            return 1;
+        }
+    }
+    install_binops(); // All the parser needs
+
+    bool ShutDown = false;
+    std::string Content;
+    while (ReadMessage(Content)) {
+        auto Msg = json::parse(Content);
+        if (!Msg) {
+            consumeError(Msg.takeError());
+            ReplyError(nullptr, -32700, "Parse error");
+            continue;
+        }
+        const json::Object *O = Msg->getAsObject();
+        auto Method = O ? O->getString("method") : None;
+        if (!Method) continue; // A response, but we never send requests
+        const json::Value *Id = O->get("id");
+        const json::Object *Params = O->getObject("params");
+        const json::Object *TextDoc = Params ? Params->getObject("textDocument") : nullptr;
+        auto URI = TextDoc ? TextDoc->getString("uri") : None;
+
+        if (*Method == "initialize" && Id) {
+            Reply(*Id, json::Object{
+                {"capabilities", json::Object{
+                    {"textDocumentSync", json::Object{{"openClose", true}, {"change", 2}}},
+                    {"definitionProvider", true}}},
+                {"serverInfo", json::Object{{"name", "Qadin_lsp"}}}});
+        } else if (*Method == "shutdown" && Id) {
+            ShutDown = true;
+            Reply(*Id, nullptr);
+        } else if (*Method == "exit") {
+            return ShutDown ? 0 : 1;
+        } else if (*Method == "textDocument/didOpen" && URI) {
+            auto Text = TextDoc->getString("text");
+            Document &Doc = Documents[URI->str()];
+            Doc.open(Text ? Text->str() : "");
+            PublishDiagnostics(URI->str(), Doc);
+        } else if (*Method == "textDocument/didChange" && URI) {
+            if (const json::Array *Changes = Params->getArray("contentChanges")) {
+                DidChange(URI->str(), *Changes);
+            }
+        } else if (*Method == "textDocument/didClose" && URI) {
+            Documents.erase(URI->str());
+        } else if (*Method == "textDocument/definition" && URI && Id) {
+            SourceLocation P;
+            if (GetPosition(Params->getObject("position"), P)) {
+                Reply(*Id, Definition(URI->str(), P));
+            } else {
+                ReplyError(*Id, -32602, "Invalid params");
+            }
+        } else if (Id) {
+            ReplyError(*Id, -32601, "Method not found");
+        }
+    }
+    return ShutDown ? 0 : 1;
+}
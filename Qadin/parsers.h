@@ -11,33 +11,74 @@ external -> 'extern' prototype
 
 function -> 'gate' prototype expr
 
-prototype -> id(args)
+import -> 'import' string
+
+prototype -> id(params) | id(params) ':' type
+params -> id params | type id params | ''
 
 expr -> primary binop_rhs
 binop_rhs -> op primary binop_rhs | ''
 
-primary -> idexpr | parenexpr | numberexpr
+primary -> idexpr | parenexpr | numberexpr | ifexpr | forexpr
 
-idexpr -> id | prototype
+idexpr -> id | prototype | id[expr] | id[expr] = expr
 args -> expr | expr, args | ''
 
 parenexpr -> ( expr )
 
 numberexpr -> number
+
+ifexpr -> 'if' expr 'then' expr 'else' expr
+
+forexpr -> 'for' id '=' expr ',' expr (',' expr)? 'in' expr
 */
 
 using namespace std;
 
-static int CurTok; // Global lookahead
+static thread_local int CurTok; // Global lookahead
+// Where tokens come from. lexer() unless the pipeline has the parser reading them
+// off a queue, in which case this also sets IdStr, NumVal and CurLoc
+static thread_local int (*TokenSource)() = lexer;
 static int getNextTok() { // Updates CurTok and returns next tok
-    return CurTok = lexer();
+    PhaseTimer T(ph_lex);
+    return CurTok = TokenSource();
+}
+
+
+/* Where messages for the user go (errors, and what expressions evaluated to): stderr,
+unless the compile server is collecting them to send back to a client. ErrorCount
+is how many errors have been reported on this thread */
+static thread_local string *ReplyOut = nullptr;
+static thread_local unsigned ErrorCount = 0;
+
+// An error and the token it was found at. The language server (document.h) sets
+// DiagnosticsOut to collect them, as they have to be placed in an editor
+struct Diagnostic {
+    SourceLocation Loc;
+    string Message;
+};
+static thread_local vector<Diagnostic> *DiagnosticsOut = nullptr;
+
+static void Report(const char *Fmt, ...) {
+    va_list Args;
+    va_start(Args, Fmt);
+    if (ReplyOut) {
+        char Buf[512];
+        int N = vsnprintf(Buf, sizeof(Buf), Fmt, Args);
+        ReplyOut->append(Buf, min(N, (int)sizeof(Buf) - 1));
+    } else {
+        vfprintf(stderr, Fmt, Args);
+    }
+    va_end(Args);
 }
 
 
 /* Helpers for error handling, for Expr's and Proto's respectively.
 Keep in mind that a Func is just a Proto and an Expr together, so these are exhaustive */
 unique_ptr<ExprAST> LogError(const char *Str) {
-    fprintf(stderr, "LogError: %s\n", Str);
+    Report("LogError: %s\n", Str);
+    ErrorCount++;
+    if (DiagnosticsOut) DiagnosticsOut->push_back({CurLoc, Str});
     return nullptr;
 }
 unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
@@ -81,7 +122,7 @@ static unique_ptr<ExprAST> ParseParenExpr() { // Call when CurrTok is '('
 
 
 /*
-3. identifierexpr -> identifier | identifier(expr*)
+3. identifierexpr -> identifier | identifier(expr*) | identifier[expr] | identifier[expr] = expr
 The * (as far as I can tell) tells us it can be a list of comma separated expr's
 */
 
@@ -90,7 +131,24 @@ static unique_ptr<ExprAST> ParseIdentifierExpr() { // Call when CurrTok is tok_i
 
     getNextTok(); 
 
-    if (CurTok != '(') { // Just a variable, not func call
+    if (CurTok == '[') { // Element of a buf
+        getNextTok(); // Eat '['
+        auto Index = ParseExpression();
+        if (!Index) return nullptr;
+
+        if (CurTok != ']') {
+            return LogError("Syntax Error: Expected ']' after index");
+        }
+        getNextTok(); // Eat ']'
+
+        if (CurTok != '=') {
+            return make_unique<IndexExprAST>(IdName, move(Index));
+        }
+        getNextTok(); // Eat '='
+        auto Val = ParseExpression();
+        if (!Val) return nullptr;
+        return make_unique<StoreExprAST>(IdName, move(Index), move(Val));
+    } else if (CurTok != '(') { // Just a variable, not func call
         return make_unique<VariableExprAST>(IdName);
     } else {
         getNextTok(); // Eat '(, advance to first arg
@@ -110,7 +168,6 @@ static unique_ptr<ExprAST> ParseIdentifierExpr() { // Call when CurrTok is tok_i
                 }
 
                 if (CurTok != ',') {
-                    printf("%d\n", CurTok);
                     return LogError("Syntax Error: Expected ')' or ',' in argument list");
                 }
 
@@ -125,24 +182,121 @@ static unique_ptr<ExprAST> ParseIdentifierExpr() { // Call when CurrTok is tok_i
 }
 
 
+/*
+3a. ifexpr -> 'if' expr 'then' expr 'else' expr
+The else is mandatory, since every expression needs a value
+*/
+
+static unique_ptr<ExprAST> ParseIfExpr() { // Call when CurrTok is tok_if
+    getNextTok(); // Eat 'if'
+
+    auto Cond = ParseExpression();
+    if (!Cond) return nullptr;
+
+    if (CurTok != tok_then) {
+        return LogError("Syntax Error: Expected 'then'");
+    }
+    getNextTok(); // Eat 'then'
+
+    auto Then = ParseExpression();
+    if (!Then) return nullptr;
+
+    if (CurTok != tok_else) {
+        return LogError("Syntax Error: Expected 'else'");
+    }
+    getNextTok(); // Eat 'else'
+
+    auto Else = ParseExpression();
+    if (!Else) return nullptr;
+
+    return make_unique<IfExprAST>(move(Cond), move(Then), move(Else));
+}
+
+
+/*
+3b. forexpr -> 'for' id '=' expr ',' expr (',' expr)? 'in' expr
+The step is optional, and defaults to 1.0 in codegen
+*/
+
+static unique_ptr<ExprAST> ParseForExpr() { // Call when CurrTok is tok_for
+    getNextTok(); // Eat 'for'
+
+    if (CurTok != tok_id) {
+        return LogError("Syntax Error: Expected identifier after 'for'");
+    }
+    string IdName = IdStr;
+    getNextTok(); // Eat identifier
+
+    if (CurTok != '=') {
+        return LogError("Syntax Error: Expected '=' after 'for' variable");
+    }
+    getNextTok(); // Eat '='
+
+    auto Start = ParseExpression();
+    if (!Start) return nullptr;
+
+    if (CurTok != ',') {
+        return LogError("Syntax Error: Expected ',' after 'for' start value");
+    }
+    getNextTok(); // Eat ','
+
+    auto End = ParseExpression();
+    if (!End) return nullptr;
+
+    unique_ptr<ExprAST> Step;
+    if (CurTok == ',') {
+        getNextTok(); // Eat ','
+        Step = ParseExpression();
+        if (!Step) return nullptr;
+    }
+
+    if (CurTok != tok_in) {
+        return LogError("Syntax Error: Expected 'in' after 'for'");
+    }
+    getNextTok(); // Eat 'in'
+
+    auto Body = ParseExpression();
+    if (!Body) return nullptr;
+
+    return make_unique<ForExprAST>(IdName, move(Start), move(End), move(Step), move(Body));
+}
+
+
 /* We now define a helper production and a helper parser to go with it
 
-4. primary = identifierexpr | numberexpr | parenexpr
+4. primary = identifierexpr | numberexpr | parenexpr | ifexpr | forexpr
 At this point, nothing is left-recursive and we can fully utilize predictive parsing
 */
 
 static unique_ptr<ExprAST> ParsePrimary() {
+    // The sub-parsers build their node after eating its tokens, so its location is
+    // taken here, from the first of them
+    SourceLocation Loc = CurLoc;
+    unique_ptr<ExprAST> E;
+
     // Note we never eat CurTok, because we've written the sub-parsers to expect to do that
     switch (CurTok) {
         case tok_id:
-            return ParseIdentifierExpr();
+        case tok_type: // vec4(...) etc. construct a vector, parsed like a call
+            E = ParseIdentifierExpr();
+            break;
         case tok_num:
-            return ParseNumberExpr();
+            E = ParseNumberExpr();
+            break;
         case '(':
-            return ParseParenExpr();
+            return ParseParenExpr(); // Keeps the location of what's inside
+        case tok_if:
+            E = ParseIfExpr();
+            break;
+        case tok_for:
+            E = ParseForExpr();
+            break;
         default:
             return LogError("Parse Error: Unknown token");
     }
+
+    if (E) E->setLoc(Loc);
+    return E;
 }
 
 
@@ -161,9 +315,11 @@ static int GetTokPrecedence() {
         return -1; // If it is not a binop (tok_num, tok_id etc.)
     }
 
-    int TokPrec = BinOpPrecedence[CurTok];
-    if (TokPrec <= 0) return -1; // If it's not installed in the map
-    return TokPrec;
+    // find, not [], which would insert: with --serve several threads parse at once,
+    // so the map is only read after install_binops
+    auto It = BinOpPrecedence.find(CurTok);
+    if (It == BinOpPrecedence.end() || It->second <= 0) return -1; // Not installed
+    return It->second;
 }
 
 // Call within main()
@@ -214,6 +370,7 @@ static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, unique_ptr<ExprAST> LHS)
         }
 
         int BinOp = CurTok; // At this point, we've established it's a BinOp 
+        SourceLocation BinLoc = CurLoc;
         getNextTok();       // and one we're allowed to evaluate, so we move on
 
         auto RHS = ParsePrimary();
@@ -232,13 +389,15 @@ static unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, unique_ptr<ExprAST> LHS)
         // Now that we're confident we're at the right precedence level, merge L/RHS
         // And loop to beginning of while with new LHS
         LHS = make_unique<BinaryExprAST>(BinOp, move(LHS), move(RHS));
+        LHS->setLoc(BinLoc);
     }
 }
 
 
 /* At this point, arbitrary expressions can be parsed. We move on to functions;
 definitions, and then declarations
-7. prototype -> id(args) 
+7. prototype -> id(params) | id(params) ':' type
+Each param is a name, optionally preceded by its type, e.g. gate scale(vec4 v k) : vec4
 */
 
 unique_ptr<PrototypeAST> ParsePrototype() {
@@ -247,14 +406,24 @@ unique_ptr<PrototypeAST> ParsePrototype() {
     }
 
     string func_name = IdStr;
+    int Line = CurLoc.Line;
     getNextTok();
     if (CurTok != '(') {
         return LogErrorP("Syntax Error: Expected '(' following function name in Prototype");
     }
 
     vector<string> argnames;
-    while(getNextTok() == tok_id) {
+    vector<QType> argtypes;
+    while(getNextTok() == tok_id || CurTok == tok_type) {
+        QType Ty = ty_double;
+        if (CurTok == tok_type) {
+            Ty = TypeFromName(IdStr);
+            if (getNextTok() != tok_id) {
+                return LogErrorP("Syntax Error: Expected argument name following type in Prototype");
+            }
+        }
         argnames.push_back(IdStr);
+        argtypes.push_back(Ty);
     }
 
     if (CurTok != ')') {
@@ -262,7 +431,21 @@ unique_ptr<PrototypeAST> ParsePrototype() {
     }
     getNextTok();
 
-    return make_unique<PrototypeAST>(func_name, move(argnames));
+    QType RetType = ty_double;
+    if (CurTok == ':') {
+        if (getNextTok() != tok_type) {
+            return LogErrorP("Syntax Error: Expected type following ':' in Prototype");
+        }
+        RetType = TypeFromName(IdStr);
+        if (RetType == ty_buf) {
+            return LogErrorP("Syntax Error: A gate can't return a buf");
+        }
+        getNextTok();
+    }
+
+    auto Proto = make_unique<PrototypeAST>(func_name, move(argnames), move(argtypes), RetType);
+    Proto->setLine(Line);
+    return Proto;
 }
 
 
@@ -272,6 +455,7 @@ Functions, or "gates"
 */
 
 static unique_ptr<FunctionAST> ParseDefn() {
+    PhaseTimer T(ph_parse);
     getNextTok(); // Eat gate
     auto Proto = ParsePrototype();
     if (!Proto) return nullptr;
@@ -288,21 +472,44 @@ static unique_ptr<FunctionAST> ParseDefn() {
 */
 
 static unique_ptr<PrototypeAST> ParseExtern() {
+    PhaseTimer T(ph_parse);
     getNextTok();
     return ParsePrototype();
 }
 
 
+/*
+10. import -> 'import' string
+
+Puts Path's gates in reach of the rest of the program, see library.h
+*/
+
+static bool ParseImport(string &Path) {
+    PhaseTimer T(ph_parse);
+    getNextTok(); // Eat import
+    if (CurTok != tok_str || IdStr.empty()) {
+        LogError("Syntax Error: Expected a library path in quotes after import");
+        return false;
+    }
+    Path = IdStr;
+    getNextTok();
+    return true;
+}
+
+
 /* Finally, we can have arbitrary "top-level" expressions. We handle by 
 defining anonymous nullary (zero argument) functions for them.
 
-10. toplevelexpr -> expr
+11. toplevelexpr -> expr
 */
 
 static unique_ptr<FunctionAST> ParseTopLevelExpr() {
+    PhaseTimer T(ph_parse);
+    int Line = CurLoc.Line;
     if (auto E = ParseExpression()) {
         // Make anonymous prototype with no arguments
         auto Proto = make_unique<PrototypeAST>("__anon_expr", vector<string>());
+        Proto->setLine(Line);
         return make_unique<FunctionAST>(move(Proto), move(E));
     }
     return nullptr;
@@ -312,7 +519,7 @@ static unique_ptr<FunctionAST> ParseTopLevelExpr() {
 /* We've now built out a fully fledged parser to our little grammar. The following
 section allows us to finally execute and test some of this, with the final production
 
-11. top -> function | external | toplevelexpr | ';'
+12. top -> function | external | import | toplevelexpr | ';'
 
 We simply write a loop which invokes the right parsers in the right situations
 */
\ No newline at end of file
@@ -0,0 +1,87 @@
+/* Queues for the pipelined front end of simple Qadin language, --pipeline
+10/18/2026
+Adin Gitig
+Sources: https://www.1024cores.net/home/lock-free-algorithms/queues
+
+The lexer, parser and codegen run on their own threads, each handing its output to
+the next through an SPSCRing: a fixed size ring buffer with one producer and one
+consumer, which needs no locks, just an index each side owns. A side that finds
+the ring full (or empty) yields until the other catches up.
+*/
+
+using namespace std;
+
+
+// How full a ring ran, and how often each side had to wait on the other
+struct RingStats {
+    uint64_t Pushes = 0;
+    uint64_t DepthSum = 0; // Items already queued, summed over every push
+    size_t MaxDepth = 0;
+    uint64_t FullWaits = 0;  // Pushes that found the ring full
+    uint64_t EmptyWaits = 0; // Pops that found it empty
+};
+
+template <typename T, size_t N>
+class SPSCRing {
+    static_assert((N & (N - 1)) == 0, "Ring size must be a power of 2");
+
+    T Slots[N];
+    // Each index is only written by one side; apart, so they don't share a cache line
+    alignas(64) atomic<size_t> Head{0}; // Next slot to pop, the consumer's
+    alignas(64) atomic<size_t> Tail{0}; // Next slot to push, the producer's
+
+    public:
+        RingStats Stats; // Safe to read once both sides are done
+
+        void push(T V) {
+            size_t Pos = Tail.load(memory_order_relaxed);
+            size_t Depth = Pos - Head.load(memory_order_acquire);
+            if (Depth == N) {
+                Stats.FullWaits++;
+                while ((Depth = Pos - Head.load(memory_order_acquire)) == N) {
+                    std::this_thread::yield();
+                }
+            }
+            Stats.Pushes++;
+            Stats.DepthSum += Depth;
+            Stats.MaxDepth = max(Stats.MaxDepth, Depth);
+
+            Slots[Pos % N] = move(V);
+            Tail.store(Pos + 1, memory_order_release);
+        }
+
+        T pop() {
+            size_t Pos = Head.load(memory_order_relaxed);
+            if (Tail.load(memory_order_acquire) == Pos) {
+                Stats.EmptyWaits++;
+                while (Tail.load(memory_order_acquire) == Pos) {
+                    std::this_thread::yield();
+                }
+            }
+            T V = move(Slots[Pos % N]);
+            Head.store(Pos + 1, memory_order_release);
+            return V;
+        }
+
+        static constexpr size_t size() {return N;}
+};
+
+
+// A token as the lexer left it, with the globals that went with it
+struct LexedToken {
+    int Kind;
+    SourceLocation Loc;
+    double Num;   // tok_num
+    string Id;    // tok_id, tok_type and tok_str
+};
+
+typedef vector<LexedToken> TokenBatch; // Tokens cross between threads in these
+
+// A top level item as the parser left it. Kind is tok_gate, tok_extern, tok_import,
+// tok_eof (the end) or 0 for an expression
+struct ParsedItem {
+    int Kind = tok_eof;
+    unique_ptr<FunctionAST> Fn;       // tok_gate and expressions
+    unique_ptr<PrototypeAST> Proto;   // tok_extern
+    string Path;                      // tok_import
+};
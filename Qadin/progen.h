@@ -0,0 +1,130 @@
+/* Synthetic program generator for simple Qadin language
+10/18/2026
+Adin Gitig
+
+Builds valid Qadin source of a requested shape, for benchmarking the compiler
+itself. Same shape and seed always give the same program.
+*/
+
+using namespace std;
+
+
+struct ProgramShape {
+    int Gates = 100;  // Gate definitions in the program
+    int Params = 2;   // Parameters per gate
+    int Depth = 3;    // Nesting depth of each body's expression tree
+    int Width = 3;    // Operands joined by binops at each level of the tree
+    int FanOut = 2;   // Calls each gate makes to gates defined before it
+    int IdLen = 8;    // Length of every identifier
+    unsigned Seed = 1;
+};
+
+struct GeneratedProgram {
+    string Src;
+    size_t Nodes = 0; // ExprAST nodes the parser will build
+    size_t Gates = 0;
+};
+
+
+class ProgramGenerator {
+    const ProgramShape &Shape;
+    GeneratedProgram &Out;
+    unsigned long long State;
+    int CurGate = 0;
+
+    unsigned Rand(unsigned N) { // xorshift, so output doesn't depend on the C library
+        State ^= State << 13;
+        State ^= State >> 7;
+        State ^= State << 17;
+        return (unsigned)(State % N);
+    }
+
+    // First letter says what it names, the rest is N in base 26 padded with 0s to
+    // IdLen. The base 26 part is all letters, so the padding can't be mistaken for
+    // part of it, and names stay unique
+    void Ident(char Kind, int N) {
+        size_t Start = Out.Src.size();
+        Out.Src += Kind;
+        do {
+            Out.Src += (char)('a' + N % 26);
+            N /= 26;
+        } while (N);
+        while ((int)(Out.Src.size() - Start) < Shape.IdLen) {
+            Out.Src += '0';
+        }
+    }
+
+    void Leaf() {
+        Out.Nodes++;
+        if (Shape.Params > 0 && Rand(2)) {
+            Ident('p', Rand(Shape.Params));
+        } else {
+            Out.Src += to_string(Rand(1000)) + "." + to_string(Rand(100));
+        }
+    }
+
+    void Call(int Depth) {
+        Out.Nodes++;
+        Ident('g', Rand(CurGate));
+        Out.Src += '(';
+        for (int i = 0; i < Shape.Params; i++) {
+            if (i) Out.Src += ", ";
+            Expr(Depth);
+        }
+        Out.Src += ')';
+    }
+
+    void Expr(int Depth) {
+        if (Depth <= 0) {
+            Leaf();
+            return;
+        }
+        static const char Ops[] = {'+', '-', '*', '<'};
+        for (int i = 0; i < Shape.Width; i++) {
+            if (i) {
+                Out.Nodes++; // The binop joining this operand on
+                Out.Src += ' ';
+                Out.Src += Ops[Rand(4)];
+                Out.Src += ' ';
+            }
+            Out.Src += '(';
+            Expr(Depth - 1);
+            Out.Src += ')';
+        }
+    }
+
+    public:
+        ProgramGenerator(const ProgramShape &Shape, GeneratedProgram &Out) :
+        Shape(Shape), Out(Out), State(Shape.Seed * 2654435761ull + 1) {}
+
+        void Gate() {
+            Out.Src += "gate ";
+            Ident('g', CurGate);
+            Out.Src += '(';
+            for (int i = 0; i < Shape.Params; i++) {
+                if (i) Out.Src += ' ';
+                Ident('p', i);
+            }
+            Out.Src += ")\n    ";
+
+            Expr(Shape.Depth);
+            for (int i = 0; CurGate > 0 && i < Shape.FanOut; i++) {
+                Out.Nodes++;
+                Out.Src += " + ";
+                Call(Shape.Depth > 0 ? Shape.Depth - 1 : 0);
+            }
+            Out.Src += ";\n";
+
+            CurGate++;
+            Out.Gates++;
+        }
+};
+
+static GeneratedProgram GenerateProgram(const ProgramShape &Shape) {
+    GeneratedProgram P;
+    ProgramGenerator G(Shape, P);
+    for (int i = 0; i < Shape.Gates; i++) {
+        G.Gate();
+    }
+    return P;
+}
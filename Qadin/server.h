@@ -0,0 +1,152 @@
+/* Compile server protocol for simple Qadin language, --serve
+10/18/2026
+Adin Gitig
+
+Clients talk to Qadin_driver --serve=<socket> over a Unix domain socket, rather than
+starting a driver (and LLVM) per compile. Each connection is a session: the gates it
+defines stay around for its later requests, in a JITDylib of its own that no other
+session sees, and go when it disconnects. A session's requests are served in order,
+different sessions' by a pool of workers at once.
+
+A request is a line "<verb> <length>\n" followed by <length> bytes of Qadin source,
+and the reply is "<status> <length>\n" followed by <length> bytes. The verbs are
+  eval     compile the source into the session, and run its top-level expressions.
+           The reply is what the driver would print, "Evaluated to" lines and errors
+  compile  compile the source on its own to a native object, which is the reply.
+           It can import libraries, but doesn't see the session's gates
+  reset    forget every gate the session has defined. The source is ignored
+status is ok, or error if anything was reported as one, and then the reply holds
+the messages.
+
+Used by both the driver and the load tester (loadtest.cpp).
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <cerrno>
+
+using namespace std;
+
+
+static bool WriteFull(int FD, const char *Data, size_t Len) {
+    while (Len) {
+        ssize_t N = write(FD, Data, Len);
+        if (N < 0 && errno == EINTR) continue;
+        if (N <= 0) return false;
+        Data += N;
+        Len -= N;
+    }
+    return true;
+}
+
+// Sends one request or reply
+static bool SendMessage(int FD, const string &Word, const string &Body) {
+    string Msg = Word + " " + to_string(Body.size()) + "\n";
+    Msg += Body; // One write, so the header doesn't go in a packet of its own
+    return WriteFull(FD, Msg.data(), Msg.size());
+}
+
+// Reads messages off a socket, through a buffer rather than a system call per byte
+class MessageReader {
+    int FD;
+    char Buf[1 << 16];
+    size_t Pos = 0, End = 0;
+
+    bool fill() {
+        ssize_t N;
+        do {
+            N = ::read(FD, Buf, sizeof(Buf));
+        } while (N < 0 && errno == EINTR);
+        if (N <= 0) return false;
+        Pos = 0;
+        End = N;
+        return true;
+    }
+
+    public:
+        MessageReader(int FD) : FD(FD) {}
+
+        // The next message. False at the end of the connection, or if it's garbled
+        bool read(string &Word, string &Body) {
+            string Header;
+            while (1) {
+                if (Pos == End && !fill()) return false;
+                char C = Buf[Pos++];
+                if (C == '\n') break;
+                Header += C;
+                if (Header.size() > 64) return false;
+            }
+
+            size_t Space = Header.find(' ');
+            if (Space == string::npos) return false;
+            Word = Header.substr(0, Space);
+            char *Rest;
+            unsigned long long Len = strtoull(Header.c_str() + Space + 1, &Rest, 10);
+            if (*Rest || Len > (1ull << 30)) return false;
+
+            Body.clear();
+            Body.reserve(Len);
+            while (Body.size() < Len) {
+                if (Pos == End && !fill()) return false;
+                size_t N = min((size_t)(End - Pos), (size_t)(Len - Body.size()));
+                Body.append(Buf + Pos, N);
+                Pos += N;
+            }
+            return true;
+        }
+};
+
+static bool SocketAddress(const char *Path, sockaddr_un &Addr) {
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (strlen(Path) >= sizeof(Addr.sun_path)) {
+        fprintf(stderr, "%s: socket path is too long\n", Path);
+        return false;
+    }
+    strcpy(Addr.sun_path, Path);
+    return true;
+}
+
+// A socket listening at Path, replacing a stale socket there but nothing else: not a
+// file, and not a socket a server is still listening on. -1 on failure
+static int ListenAt(const char *Path) {
+    sockaddr_un Addr;
+    if (!SocketAddress(Path, Addr)) return -1;
+    struct stat St;
+    if (!lstat(Path, &St)) {
+        if (!S_ISSOCK(St.st_mode)) {
+            fprintf(stderr, "%s: exists and isn't a socket\n", Path);
+            return -1;
+        }
+        // Stale only if nothing answers
+        int Probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (Probe < 0) {
+            perror("socket");
+            return -1;
+        }
+        int Err = connect(Probe, (sockaddr *)&Addr, sizeof(Addr)) ? errno : 0;
+        close(Probe);
+        if (!Err) {
+            fprintf(stderr, "%s: already in use by a running server\n", Path);
+            return -1;
+        }
+        if (Err != ECONNREFUSED) {
+            errno = Err;
+            perror(Path);
+            return -1;
+        }
+        unlink(Path);
+    }
+    int FD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (bind(FD, (sockaddr *)&Addr, sizeof(Addr)) || listen(FD, 128)) {
+        perror(Path);
+        close(FD);
+        return -1;
+    }
+    return FD;
+}
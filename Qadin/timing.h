@@ -0,0 +1,291 @@
+/* Per-phase timing for simple Qadin language, --time-report and --trace
+10/18/2026
+Adin Gitig
+
+Wrap a phase of the compiler in a PhaseTimer and its wall time, CPU time and
+allocations are added up for the report. Timers nest, and each phase is only
+charged for its own time (parsing doesn't include the lexing it triggers, etc.)
+
+With --trace, every phase and every top level item (TraceSpan) also becomes a span
+in a Chrome trace-event file, which chrome://tracing and ui.perfetto.dev can open.
+*/
+
+using namespace std;
+
+
+enum Phase {
+    ph_lex,
+    ph_parse,
+    ph_load,     // Reading a --load-ast file back into ASTs
+    ph_ast,      // Passes over the AST, such as -v and --dump-ast
+    ph_irgen,
+    ph_link,     // Bringing in imported gates
+    ph_verify,
+    ph_optimize,
+    ph_emit,     // Machine code, which the JIT emits when a symbol is first looked up
+    ph_execute,
+    ph_output,   // Printing IR
+    NumPhases
+};
+
+static const char *PhaseNames[NumPhases] = {"lex", "parse", "load", "ast", "irgen", "link",
+"verify", "optimize", "emit", "execute", "output"};
+
+static bool TimeReport = false; // Nothing is measured unless this or Tracing is set
+static bool Tracing = false;
+static double TraceEpoch = 0; // Trace timestamps count from here
+
+// Bumped by every operator new, if the program replaces it to do so (the driver does)
+static thread_local uint64_t ThreadAllocs = 0, ThreadAllocBytes = 0;
+
+struct PhaseStats {
+    double WallNs = 0, CPUNs = 0;
+    uint64_t Allocs = 0, AllocBytes = 0, Count = 0;
+
+    void add(const PhaseStats &O) {
+        WallNs += O.WallNs;
+        CPUNs += O.CPUNs;
+        Allocs += O.Allocs;
+        AllocBytes += O.AllocBytes;
+        Count += O.Count;
+    }
+};
+
+// A finished span, for --trace
+struct TraceEvent {
+    string Name;
+    const char *Cat;
+    double BeginNs, EndNs;
+    int Tid;
+};
+
+static mutex PhaseMutex;
+static PhaseStats MergedPhases[NumPhases]; // From threads that have finished, or reported
+static vector<TraceEvent> MergedTrace;
+static atomic<int> NextTid(1); // Small ids read better in a trace viewer than OS ones
+
+static double WallNow() {
+    return chrono::duration<double, nano>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double CPUNow() {
+    struct timespec TS;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &TS);
+    return TS.tv_sec * 1e9 + TS.tv_nsec;
+}
+
+// Reading the thread's CPU clock is a system call, far too slow to do per token. So
+// lexing only gets wall time, and its CPU time stays with the phase that asked for
+// the token (almost always parse)
+static bool FinePhase(Phase P) {
+    return P == ph_lex;
+}
+
+struct PhaseThreadState {
+    struct Frame {
+        Phase P;
+        double Begin; // WallStart moves on as nested phases finish, this doesn't
+        double WallStart, CPUStart;
+        uint64_t AllocStart, BytesStart;
+    };
+    PhaseStats Stats[NumPhases];
+    vector<Frame> Stack;
+    vector<TraceEvent> Trace;
+    int Tid = NextTid++;
+
+    // Charges the phase on top of the stack for everything since its last start
+    void charge(double Wall, double CPU, bool WithCPU) {
+        Frame &F = Stack.back();
+        PhaseStats &S = Stats[F.P];
+        S.WallNs += Wall - F.WallStart;
+        S.Allocs += ThreadAllocs - F.AllocStart;
+        S.AllocBytes += ThreadAllocBytes - F.BytesStart;
+        if (WithCPU) {
+            S.CPUNs += CPU - F.CPUStart;
+        }
+    }
+
+    void push(Phase P) {
+        double Wall = WallNow(), CPU = FinePhase(P) ? 0 : CPUNow();
+        if (!Stack.empty()) {
+            charge(Wall, CPU, !FinePhase(P));
+        }
+        Stack.push_back({P, Wall, Wall, CPU, ThreadAllocs, ThreadAllocBytes});
+        Stats[P].Count++;
+    }
+
+    void pop() {
+        bool Fine = FinePhase(Stack.back().P);
+        double Wall = WallNow(), CPU = Fine ? 0 : CPUNow();
+        charge(Wall, CPU, !Fine);
+        if (Tracing && !Fine) { // Spans per token would drown everything else
+            Trace.push_back({PhaseNames[Stack.back().P], "phase", Stack.back().Begin, Wall, Tid});
+        }
+        Stack.pop_back();
+        if (!Stack.empty()) { // The outer phase picks up again from here
+            Frame &F = Stack.back();
+            F.WallStart = Wall;
+            F.AllocStart = ThreadAllocs;
+            F.BytesStart = ThreadAllocBytes;
+            if (!Fine) {
+                F.CPUStart = CPU;
+            }
+        }
+    }
+
+    void merge() {
+        lock_guard<mutex> Lock(PhaseMutex);
+        for (int i = 0; i < NumPhases; i++) {
+            MergedPhases[i].add(Stats[i]);
+            Stats[i] = PhaseStats();
+        }
+        MergedTrace.insert(MergedTrace.end(), Trace.begin(), Trace.end());
+        Trace.clear();
+    }
+
+    ~PhaseThreadState() {
+        merge();
+    }
+};
+
+static thread_local PhaseThreadState ThreadPhases;
+
+class PhaseTimer {
+    bool Active;
+
+    public:
+        PhaseTimer(Phase P) : Active(TimeReport || Tracing) {
+            if (Active) ThreadPhases.push(P);
+        }
+        ~PhaseTimer() {
+            if (Active) ThreadPhases.pop();
+        }
+};
+
+
+// One top level item (gate, extern or expression) in the trace. Phases run while it's
+// alive nest inside it. Give it its real name once that has been parsed
+class TraceSpan {
+    string Name;
+    double Begin;
+
+    public:
+        TraceSpan(const char *Name) : Name(Tracing ? Name : ""), Begin(Tracing ? WallNow() : 0) {}
+        void rename(const string &N) {
+            if (Tracing) Name = N;
+        }
+        ~TraceSpan() {
+            if (Tracing) {
+                ThreadPhases.Trace.push_back({move(Name), "item", Begin, WallNow(), ThreadPhases.Tid});
+            }
+        }
+};
+
+
+static long PeakRSSKB() {
+    struct rusage RU;
+    getrusage(RUSAGE_SELF, &RU);
+    return RU.ru_maxrss; // Already KB on Linux
+}
+
+// Totals so far over every thread that has finished, plus the calling one
+static void CollectPhases(PhaseStats (&Out)[NumPhases], PhaseStats &Total) {
+    ThreadPhases.merge();
+    lock_guard<mutex> Lock(PhaseMutex);
+    for (int i = 0; i < NumPhases; i++) {
+        Out[i] = MergedPhases[i];
+        Total.add(Out[i]);
+    }
+}
+
+static void PrintTimeReport(FILE *F) {
+    PhaseStats Phases[NumPhases], Total;
+    CollectPhases(Phases, Total);
+
+    fprintf(F, "===-------------------------------------------------------------------------===\n");
+    fprintf(F, "                           Qadin time report\n");
+    fprintf(F, "===-------------------------------------------------------------------------===\n");
+    fprintf(F, "  %-10s %11s %6s %11s %10s %11s %10s\n", "Phase", "Wall (ms)", "%", "CPU (ms)",
+    "Allocs", "Alloc (KB)", "Count");
+    for (int i = 0; i < NumPhases; i++) {
+        PhaseStats &S = Phases[i];
+        if (!S.Count) continue;
+        fprintf(F, "  %-10s %11.3f %5.1f%% ", PhaseNames[i], S.WallNs / 1e6,
+        Total.WallNs ? 100 * S.WallNs / Total.WallNs : 0);
+        if (FinePhase((Phase)i)) {
+            fprintf(F, "%11s ", "-");
+        } else {
+            fprintf(F, "%11.3f ", S.CPUNs / 1e6);
+        }
+        fprintf(F, "%10llu %11.1f %10llu\n", (unsigned long long)S.Allocs, S.AllocBytes / 1024.0,
+        (unsigned long long)S.Count);
+    }
+    fprintf(F, "  %-10s %11.3f %5.1f%% %11.3f %10llu %11.1f\n", "Total", Total.WallNs / 1e6, 100.0,
+    Total.CPUNs / 1e6, (unsigned long long)Total.Allocs, Total.AllocBytes / 1024.0);
+    fprintf(F, "  Peak RSS: %.1f MB\n", PeakRSSKB() / 1024.0);
+    fprintf(F, "  (lex CPU time is counted in the phase that asked for the token)\n");
+}
+
+static void WriteTimeReportJSON(FILE *F) {
+    PhaseStats Phases[NumPhases], Total;
+    CollectPhases(Phases, Total);
+
+    fprintf(F, "{\n  \"phases\": [\n");
+    bool First = true;
+    for (int i = 0; i < NumPhases; i++) {
+        PhaseStats &S = Phases[i];
+        if (!S.Count) continue;
+        fprintf(F, "%s    {\"name\": \"%s\", \"wall_ms\": %.6f, ", First ? "" : ",\n", PhaseNames[i],
+        S.WallNs / 1e6);
+        if (FinePhase((Phase)i)) {
+            fprintf(F, "\"cpu_ms\": null, ");
+        } else {
+            fprintf(F, "\"cpu_ms\": %.6f, ", S.CPUNs / 1e6);
+        }
+        fprintf(F, "\"allocs\": %llu, \"alloc_bytes\": %llu, \"count\": %llu}",
+        (unsigned long long)S.Allocs, (unsigned long long)S.AllocBytes, (unsigned long long)S.Count);
+        First = false;
+    }
+    fprintf(F, "\n  ],\n  \"total\": {\"wall_ms\": %.6f, \"cpu_ms\": %.6f, \"allocs\": %llu, "
+    "\"alloc_bytes\": %llu},\n", Total.WallNs / 1e6, Total.CPUNs / 1e6,
+    (unsigned long long)Total.Allocs, (unsigned long long)Total.AllocBytes);
+    fprintf(F, "  \"peak_rss_kb\": %ld\n}\n", PeakRSSKB());
+}
+
+// S as the inside of a JSON string. Span names can hold paths, which can hold anything
+static void WriteJSONEscaped(FILE *F, const string &S) {
+    for (char C : S) {
+        if (C == '"' || C == '\\') {
+            fputc('\\', F);
+            fputc(C, F);
+        } else if ((unsigned char)C < 0x20) {
+            fprintf(F, "\\u%04x", C);
+        } else {
+            fputc(C, F);
+        }
+    }
+}
+
+// Writes every span so far, from threads that have finished and the calling one, in
+// the Chrome trace-event format. Times there are in microseconds
+static void WriteTraceJSON(FILE *F) {
+    ThreadPhases.merge();
+    lock_guard<mutex> Lock(PhaseMutex);
+
+    fprintf(F, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(F, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+    "\"args\": {\"name\": \"Qadin\"}}");
+    for (int Tid = 1; Tid < NextTid; Tid++) {
+        string Name = Tid == 1 ? "main" : "worker " + to_string(Tid - 1);
+        fprintf(F, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+        "\"args\": {\"name\": \"%s\"}}", Tid, Name.c_str());
+    }
+    for (auto &E : MergedTrace) {
+        fprintf(F, ",\n  {\"name\": \"");
+        WriteJSONEscaped(F, E.Name);
+        fprintf(F, "\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+        "\"dur\": %.3f, \"pid\": 1, \"tid\": %d}", E.Cat,
+        (E.BeginNs - TraceEpoch) / 1e3, (E.EndNs - E.BeginNs) / 1e3, E.Tid);
+    }
+    fprintf(F, "\n]}\n");
+}
@@ -1,130 +1,240 @@
 /* Tree support for parsers
 Adin Gitig
-Tree visualization algorithm from:
- https://stackoverflow.com/questions/801740/c-how-to-draw-a-binary-tree-to-the-console
 4/17/22
+
+Nodes come out of blocks of STREE_BLOCK at a time rather than a malloc each.
+freeTree puts a tree's nodes on a free list for emptyNode to hand out again, and
+freeAllTrees takes back every node at once, keeping the blocks. Nothing here
+recurses, so a tree can be as deep as memory allows.
+
+printTree draws a tree top down, a row per level:
+
+      _-
+     /  \
+     +  a
+    / \
+    a a
+
+Each node gets its own column, its place in an in-order walk, so subtrees never
+overlap and laying out n nodes is O(n). The drawing is as big as it looks, one row
+per level and one column per node, so writeTree to a file for large trees.
 */
 
-#include <math.h>
+#include <string.h>
+
+#define STREE_BLOCK 4096
 
 typedef struct Stree Stree;
 struct Stree {
     char term;
+    int col;   /* Where writeTree last put it, fits in the padding after term */
     Stree* left;
     Stree* right;
 };
 
+typedef struct StreeBlock StreeBlock;
+struct StreeBlock {
+    StreeBlock* next;
+    Stree nodes[STREE_BLOCK];
+};
+
+StreeBlock* firstBlock = NULL;
+StreeBlock* curBlock = NULL;   /* Nodes are handed out from here, after the free list */
+int blockUsed = 0;
+Stree* freeNodes = NULL;       /* Linked through right */
+
 Stree* emptyNode(char c) {
-    Stree* new = (Stree*) malloc(sizeof(Stree));
-    if (!new) {
-        fprintf(stderr, "emptyNode: failed to allocate\n");
-        exit(1);
+    Stree* new;
+    if (freeNodes) {
+        new = freeNodes;
+        freeNodes = new->right;
+    } else {
+        if (!curBlock || blockUsed == STREE_BLOCK) {
+            StreeBlock* next = curBlock ? curBlock->next : firstBlock;
+            if (!next) {
+                next = (StreeBlock*) malloc(sizeof(StreeBlock));
+                if (!next) {
+                    fprintf(stderr, "emptyNode: failed to allocate\n");
+                    exit(1);
+                }
+                next->next = NULL;
+                if (curBlock) {
+                    curBlock->next = next;
+                } else {
+                    firstBlock = next;
+                }
+            }
+            curBlock = next;
+            blockUsed = 0;
+        }
+        new = &curBlock->nodes[blockUsed++];
     }
     new->term = c;
+    new->col = 0;
     new->left = new->right = NULL;
     return new;
 }
 
+/* Rotates left subtrees up until the node has none, then frees it and carries on
+down the right, so it needs no stack */
 void freeTree(Stree* t) {
-    if(t) {
-        freeTree(t->left);
-        freeTree(t->right);
-        freeTree(t);
+    while (t) {
+        if (t->left) {
+            Stree* l = t->left;
+            t->left = l->right;
+            l->right = t;
+            t = l;
+        } else {
+            Stree* r = t->right;
+            t->right = freeNodes;
+            freeNodes = t;
+            t = r;
+        }
     }
-    return;
 }
 
-
-int treeLen(Stree* t) {
-    if (!t) {
-        return 0;
-    }
-    return 1 + treeLen(t->left) + treeLen(t->right);
+/* Every node goes back, whether or not it's in a tree that was freed */
+void freeAllTrees() {
+    curBlock = NULL;
+    blockUsed = 0;
+    freeNodes = NULL;
 }
 
-Stree** createQueue(int* front, int* rear, int len)
-{
-	Stree** queue = (Stree**)malloc(sizeof(Stree*) * len);
 
-	*front = *rear = 0;
-	return queue;
-}
+/* A stack of nodes, for walking trees without recursing */
+typedef struct StreeStack StreeStack;
+struct StreeStack {
+    Stree** nodes;
+    int* depths;
+    int len;
+    int cap;
+};
 
-void enQueue(Stree** queue, int* rear, Stree* new_node)
-{
-	queue[*rear] = new_node;
-	(*rear)++;
+void streePush(StreeStack* s, Stree* t, int depth) {
+    if (s->len == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->nodes = (Stree**) realloc(s->nodes, sizeof(Stree*) * s->cap);
+        s->depths = (int*) realloc(s->depths, sizeof(int) * s->cap);
+        if (!s->nodes || !s->depths) {
+            fprintf(stderr, "streePush: failed to allocate\n");
+            exit(1);
+        }
+    }
+    s->nodes[s->len] = t;
+    s->depths[s->len] = depth;
+    s->len++;
 }
 
-Stree* deQueue(Stree** queue, int* front)
-{
-	(*front)++;
-	return queue[*front - 1];
+void streeStackFree(StreeStack* s) {
+    free(s->nodes);
+    free(s->depths);
 }
 
-Stree** tree_to_arr(Stree* t, int len)
-{
-	int rear, front, i;
-    i = 0;
-
-	Stree** queue = createQueue(&front, &rear, len);
-    Stree** arr = (Stree**)malloc(sizeof(Stree*) * len);
-	Stree* temp = t;
-
-	while (temp) {
-		arr[i] = temp;
-
-		/*Enqueue left child */
-		if (temp->left)
-			enQueue(queue, &rear, temp->left);
-
-		/*Enqueue right child */
-		if (temp->right)
-			enQueue(queue, &rear, temp->right);
-
-		/*Dequeue node and make it temp_node*/
-		temp = deQueue(queue, &front);
+int treeLen(Stree* t) {
+    StreeStack s = {0};
+    int len = 0;
+    if (t) streePush(&s, t, 0);
+    while (s.len) {
+        t = s.nodes[--s.len];
+        len++;
+        if (t->left) streePush(&s, t->left, 0);
+        if (t->right) streePush(&s, t->right, 0);
+    }
+    streeStackFree(&s);
+    return len;
+}
 
-        i++;
-	}
 
-    free(queue);
-    return arr;
+/* p, or exits if the allocation it came from failed */
+void* writeTreeAlloc(void* p) {
+    if (!p) {
+        fprintf(stderr, "writeTree: failed to allocate\n");
+        exit(1);
+    }
+    return p;
 }
 
-
-void printTree(Stree* t) {
+/* Draws t into f. Columns come from an in-order walk, which also gives each node's
+depth; a counting sort by depth then gives the rows, each still in column order */
+void writeTree(Stree* t, FILE* f) {
     int len = treeLen(t);
-    Stree** arr = tree_to_arr(t, len);
-
-    int print_pos[len];
-    int i, j, k, pos, x=1, level=0;
-
-    print_pos[0] = 0;
-    for(i=0, j=1; i<len; i++,j++) {
-        pos = print_pos[(i-1)/2] + (i%2?-1:1)*(70/(pow(2,level+1))+1);
-
-        for (k=0; k<pos-x; k++) printf("%c",i==0||i%2?' ':'~');
-        printf("%c",arr[i]->term);
-
-        print_pos[i] = x = pos+1;
-        if (j==pow(2,level)) {
-            printf("\n");
-            level++;
-            x = 1;
-            j = 0;
+    if (!len) return;
+    Stree** inorder = (Stree**) writeTreeAlloc(malloc(sizeof(Stree*) * len));
+    int* depth = (int*) writeTreeAlloc(malloc(sizeof(int) * len));
+    int i = 0, rows = 0;
+
+    StreeStack s = {0};
+    Stree* cur = t;
+    int d = 0;
+    while (cur || s.len) {
+        while (cur) {
+            streePush(&s, cur, d++);
+            cur = cur->left;
+        }
+        s.len--;
+        cur = s.nodes[s.len];
+        d = s.depths[s.len];
+        cur->col = i;
+        inorder[i] = cur;
+        depth[i++] = d;
+        if (d >= rows) rows = d + 1;
+        cur = cur->right;
+        d++;
+    }
+    streeStackFree(&s);
+
+    int* rowStart = (int*) writeTreeAlloc(calloc(rows + 1, sizeof(int)));
+    Stree** byRow = (Stree**) writeTreeAlloc(malloc(sizeof(Stree*) * len));
+    char* line = (char*) writeTreeAlloc(malloc(len + 2));
+    for (i = 0; i < len; i++) rowStart[depth[i] + 1]++;
+    for (i = 0; i < rows; i++) rowStart[i + 1] += rowStart[i];
+    for (i = 0; i < len; i++) byRow[rowStart[depth[i]]++] = inorder[i];
+    for (i = rows; i > 0; i--) rowStart[i] = rowStart[i - 1]; /* Back to the starts */
+    rowStart[0] = 0;
+
+    for (int r = 0; r < rows; r++) {
+        /* The nodes, with _ out to where their children are */
+        int end = 0, children = 0;
+        for (i = rowStart[r]; i < rowStart[r + 1]; i++) {
+            Stree* n = byRow[i];
+            int from = n->left ? n->left->col + 1 : n->col;
+            int to = n->right ? n->right->col : n->col + 1;
+            memset(line + end, ' ', from - end);
+            memset(line + from, '_', to - from);
+            line[n->col] = n->term;
+            end = to;
+            children |= n->left || n->right;
         }
+        line[end++] = '\n';
+        fwrite(line, 1, end, f);
+        if (!children) continue;
+
+        /* And the / and \ down to them */
+        end = 0;
+        for (i = rowStart[r]; i < rowStart[r + 1]; i++) {
+            Stree* n = byRow[i];
+            if (n->left) {
+                memset(line + end, ' ', n->left->col - end);
+                line[n->left->col] = '/';
+                end = n->left->col + 1;
+            }
+            if (n->right) {
+                memset(line + end, ' ', n->right->col - end);
+                line[n->right->col] = '\\';
+                end = n->right->col + 1;
+            }
+        }
+        line[end++] = '\n';
+        fwrite(line, 1, end, f);
     }
 
-    free(arr);
+    free(inorder);
+    free(depth);
+    free(rowStart);
+    free(byRow);
+    free(line);
 }
 
-/*
-    C
-   / \
-  B   D
- /     \
-A 
-
-
-*/
\ No newline at end of file
+void printTree(Stree* t) {
+    writeTree(t, stdout);
+}
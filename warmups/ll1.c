@@ -0,0 +1,160 @@
+/* Table-driven LL(1) parser
+Dragon book 4.4.4, the nonrecursive predictive parser
+Adin Gitig
+10/18/26
+
+One driver for any grammar ll1gen.c takes, built against its table:
+
+    ./ll1gen S.ll1 S_table.h
+    gcc -O2 -DLL1_TABLE='"S_table.h"' ll1.c -o ll1_S
+
+(make ll1 does this for S.ll1 and E.ll1.) Like predictive_parser.c it reads a
+sentence per line until a line starting with q, but keeps its own stack of grammar
+symbols rather than recursing, so deep nesting costs a few bytes per level instead
+of a C stack frame. The grammar's actions print as they're reached, so on valid
+input ll1_S and ll1_E print exactly what parse 1 and parse 2 do.
+
+-g N writes N random sentences from the grammar instead, each around -n tokens
+long (100 by default), ending with the q line. So
+
+    ./ll1_S -g 1000 -n 10000 > S.in
+    time ./parse 1 < S.in > /dev/null
+    time ./ll1_S < S.in > /dev/null
+
+compares the two ways of parsing on the same input.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include LL1_TABLE
+
+#define END (LL1_TERMS - 1)   /* $, the newline */
+
+short* stack = NULL;
+int sp = 0, cap = 0;
+
+void reserve(int n) {
+    if (sp + n <= cap) return;
+    while (sp + n > cap) cap = cap ? cap * 2 : 1024;
+    stack = (short*) realloc(stack, sizeof(short) * cap);
+    if (!stack) {
+        fprintf(stderr, "reserve: failed to allocate\n");
+        exit(1);
+    }
+}
+
+/* The column of the next token, skipping spaces, and the character in *c. The end
+of the line or the input is END, and anything that isn't a terminal -1 */
+int next(int* c) {
+    do {
+        *c = getchar();
+    } while (*c == ' ');
+    return *c == EOF ? END : ll1_column[(unsigned char) *c];
+}
+
+/* Parses the rest of a line, starting with the token in column la. Returns 0 at a
+syntax error, leaving *c where it happened */
+int parse(int* c, int la) {
+    sp = 0;
+    reserve(1);
+    stack[sp++] = LL1_NONTERM;
+    while (sp) {
+        int x = stack[--sp];
+        if (x >= LL1_ACTION) {
+            const char* s = ll1_actions[x - LL1_ACTION];
+            if (s[0] && !s[1]) {
+                putchar(s[0]); /* Most are, and this is much cheaper than fputs */
+            } else {
+                fputs(s, stdout);
+            }
+        } else if (x >= LL1_NONTERM) {
+            int p = la < 0 ? -1 : ll1_table[x - LL1_NONTERM][la];
+            if (p < 0) return 0;
+            reserve(ll1_start[p + 1] - ll1_start[p]);
+            for (int i = ll1_start[p]; i < ll1_start[p + 1]; i++) {
+                stack[sp++] = ll1_rhs[i];
+            }
+        } else if (x == la) {
+            la = next(c);
+        } else {
+            return 0;
+        }
+    }
+    return la == END;
+}
+
+/* Expands nonterminals at random until the sentence has about size tokens, then
+finishes it as quickly as the grammar allows. Never ends early by choice while
+there's only one nonterminal left, so sentences don't stop at a few tokens */
+void generate(int count, int size) {
+    for (int k = 0; k < count; k++) {
+        int tokens = 0, pending = 1;   /* Nonterminals on the stack */
+        sp = 0;
+        reserve(1);
+        stack[sp++] = LL1_NONTERM;
+        while (sp) {
+            int x = stack[--sp];
+            if (x >= LL1_ACTION) {
+                continue;
+            } else if (x < LL1_NONTERM) {
+                putchar(ll1_terms[x]);
+                tokens++;
+                continue;
+            }
+            int a = x - LL1_NONTERM;
+            int lo = ll1_prods[a], n = ll1_prods[a + 1] - lo;
+            int p = ll1_shortest[a];
+            pending--;
+            if (tokens + pending < size) {
+                int skip = !pending && n > 1; /* Leave out the shortest */
+                p = lo + (p - lo + skip + rand() % (n - skip)) % n;
+            }
+            reserve(ll1_start[p + 1] - ll1_start[p]);
+            for (int i = ll1_start[p]; i < ll1_start[p + 1]; i++) {
+                stack[sp++] = ll1_rhs[i];
+                pending += ll1_rhs[i] >= LL1_NONTERM && ll1_rhs[i] < LL1_ACTION;
+            }
+        }
+        putchar('\n');
+    }
+    printf("q\n");
+}
+
+
+int main(int argc, char** argv) {
+    int count = -1, size = 100;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [-g <sentences> [-n <tokens>]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (count >= 0) {
+        generate(count, size);
+        return 0;
+    }
+
+    while (1) {
+        int c;
+        int la = next(&c);
+        if (c == 'q' || c == EOF) {
+            break;
+        }
+
+        if (!parse(&c, la)) {
+            fprintf(stderr, "Syntax Error\n");
+            while (c != '\n' && c != EOF) {
+                c = getchar(); // clear buffer
+            }
+        }
+
+        printf("\n\n");
+    }
+    free(stack);
+    return 0;
+}
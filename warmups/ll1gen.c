@@ -0,0 +1,546 @@
+/* LL(1) parser generator
+Dragon book 4.4: FIRST, FOLLOW and the predictive parsing table
+Adin Gitig
+10/18/26
+
+Reads a grammar and writes its LL(1) parse table as a C header, for ll1.c to
+include. That one driver then parses any grammar given to this, with an explicit
+stack instead of a function per nonterminal:
+
+    ./ll1gen S.ll1 S_table.h
+    gcc -DLL1_TABLE='"S_table.h"' ll1.c -o ll1_S
+
+A grammar is rules like
+
+    # Grammar 1 of predictive_parser.c
+    S -> + {[+} S S {]}
+       | a {a}
+
+The first rule's left side is the start symbol. Anything that is some rule's left
+side is a nonterminal, and every other symbol is a terminal, one character
+(quoted, 'x', if it's one of -> | { } # '). '' is the empty string. {text} is an
+action: the driver prints text when it gets to it, so S.ll1 prints what the
+recursive S() does. Input is one sentence per line, spaces between tokens are
+skipped, and the newline is the end marker, written $ below.
+
+If two productions land in the same table entry the grammar isn't LL(1): each
+conflict is reported and no table is written. -v prints FIRST and FOLLOW.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXTERMS 128   /* Columns, including $ */
+#define MAXNONTERMS 128
+#define MAXPRODS 1024
+#define MAXRHS 64
+#define MAXACTIONS 1024
+
+/* Symbols in a right hand side: terminals are their column, nonterminals
+NONTERM + index and actions ACTION + index */
+#define NONTERM 1000
+#define ACTION 2000
+
+char terms[MAXTERMS];   /* The character for each column. The last is '\n', $ */
+int nterms = 0;
+char* nonterms[MAXNONTERMS];
+int nnonterms = 0;
+char* actions[MAXACTIONS];
+int nactions = 0;
+
+typedef struct Production Production;
+struct Production {
+    int lhs;
+    int len;
+    int rhs[MAXRHS];
+    int line;
+};
+Production prods[MAXPRODS];
+int nprods = 0;
+
+char nullable[MAXNONTERMS];
+char first[MAXNONTERMS][MAXTERMS];
+char follow[MAXNONTERMS][MAXTERMS];
+int shortest[MAXNONTERMS];   /* Production with the fewest terminals in a sentence */
+int table[MAXNONTERMS][MAXTERMS];
+
+
+/* Reading the grammar. Every word is kept as a string until all the left sides
+are known, since a nonterminal can be used before its rule */
+
+typedef struct Word Word;
+struct Word {
+    char* text;
+    int quoted;   /* 'x', always a terminal */
+    int action;   /* {text} */
+    int line;
+};
+Word* words;
+int nwords = 0, capwords = 0;
+
+/* line 0 is for errors in the grammar as a whole */
+void fail(int line, const char* msg, const char* what) {
+    if (line) fprintf(stderr, "line %d: ", line);
+    fprintf(stderr, "%s%s\n", msg, what);
+    exit(1);
+}
+
+void addWord(char* text, int quoted, int action, int line) {
+    if (nwords == capwords) {
+        capwords = capwords ? capwords * 2 : 256;
+        words = (Word*) realloc(words, sizeof(Word) * capwords);
+        if (!words) {
+            fprintf(stderr, "ll1gen: failed to allocate\n");
+            exit(1);
+        }
+    }
+    words[nwords].text = text;
+    words[nwords].quoted = quoted;
+    words[nwords].action = action;
+    words[nwords].line = line;
+    nwords++;
+}
+
+void readWords(FILE* f) {
+    int c, line = 1;
+    char buf[1024];
+    while ((c = getc(f)) != EOF) {
+        int n = 0;
+        if (c == '\n') {
+            line++;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+        } else if (c == '#') {
+            while ((c = getc(f)) != EOF && c != '\n');
+            line++;
+        } else if (c == '{') {
+            /* Up to the matching }, with \n, \t, \\ and \} escapes */
+            while ((c = getc(f)) != '}') {
+                if (c == EOF) fail(line, "unterminated action", "");
+                if (c == '\n') line++;
+                if (c == '\\') {
+                    c = getc(f);
+                    c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+                }
+                if (n == sizeof(buf) - 1) fail(line, "action too long", "");
+                buf[n++] = c;
+            }
+            buf[n] = 0;
+            addWord(strdup(buf), 0, 1, line);
+        } else if (c == '\'') {
+            buf[n++] = getc(f);
+            if (buf[0] == '\'') {
+                n = 0; /* '' */
+            } else if (getc(f) != '\'') {
+                fail(line, "a quoted terminal is one character", "");
+            }
+            buf[n] = 0;
+            addWord(strdup(buf), 1, 0, line);
+        } else {
+            do {
+                if (n == sizeof(buf) - 1) fail(line, "symbol too long", "");
+                buf[n++] = c;
+            } while ((c = getc(f)) != EOF && !strchr(" \t\r\n#{'", c));
+            ungetc(c, f);
+            buf[n] = 0;
+            addWord(strdup(buf), 0, 0, line);
+        }
+    }
+}
+
+int isWord(int i, const char* s) {
+    return i < nwords && !words[i].quoted && !words[i].action && !strcmp(words[i].text, s);
+}
+
+int findNonterm(const char* name) {
+    for (int i = 0; i < nnonterms; i++) {
+        if (!strcmp(nonterms[i], name)) return i;
+    }
+    return -1;
+}
+
+int findTerm(char c) {
+    for (int i = 0; i < nterms; i++) {
+        if (terms[i] == c) return i;
+    }
+    if (nterms == MAXTERMS - 1) fail(0, "too many terminals", "");
+    terms[nterms] = c;
+    return nterms++;
+}
+
+/* A rule is "A ->" and its alternatives, up to the next "B ->" */
+void readGrammar(FILE* f) {
+    readWords(f);
+    for (int i = 0; i + 1 < nwords; i++) {
+        if (isWord(i + 1, "->") && !words[i].quoted && !words[i].action &&
+        findNonterm(words[i].text) < 0) {
+            if (nnonterms == MAXNONTERMS) fail(words[i].line, "too many nonterminals", "");
+            nonterms[nnonterms++] = words[i].text;
+        }
+    }
+    if (!nnonterms) fail(1, "no rules", "");
+    if (!isWord(1, "->")) fail(words[0].line, "expected a rule, not ", words[0].text);
+
+    Production* p = NULL;
+    for (int i = 0; i < nwords; i++) {
+        Word* w = &words[i];
+        if (isWord(i + 1, "->")) {
+            p = NULL;
+        }
+        if (!p || isWord(i, "|")) {
+            if (nprods == MAXPRODS) fail(w->line, "too many productions", "");
+            int lhs = p ? p->lhs : findNonterm(w->text);
+            if (lhs < 0) fail(w->line, "a left side must be a plain symbol, not ", w->text);
+            p = &prods[nprods++];
+            p->lhs = lhs;
+            p->len = 0;
+            p->line = w->line;
+            if (!isWord(i, "|")) i++; /* Past -> */
+            continue;
+        }
+        if (isWord(i, "->")) fail(w->line, "misplaced ", "->");
+
+        int sym;
+        if (w->action) {
+            if (nactions == MAXACTIONS) fail(w->line, "too many actions", "");
+            actions[nactions] = w->text;
+            sym = ACTION + nactions++;
+        } else if (!w->quoted && findNonterm(w->text) >= 0) {
+            sym = NONTERM + findNonterm(w->text);
+        } else if (!w->text[0]) {
+            continue; /* '' */
+        } else if (w->text[1]) {
+            fail(w->line, "not a nonterminal, and too long for a terminal: ", w->text);
+        } else if (w->text[0] == ' ' || w->text[0] == '\n') {
+            fail(w->line, "space and newline can't be terminals", "");
+        } else {
+            sym = findTerm(w->text[0]);
+        }
+        if (p->len == MAXRHS) fail(w->line, "production too long", "");
+        p->rhs[p->len++] = sym;
+    }
+    terms[nterms++] = '\n'; /* $ */
+}
+
+
+/* FIRST and FOLLOW, by iterating to a fixed point */
+
+/* Adds FIRST of rhs[from..] to set. Returns whether that part of the rhs is nullable */
+int firstOf(Production* p, int from, char* set, int* changed) {
+    for (int i = from; i < p->len; i++) {
+        int s = p->rhs[i];
+        if (s >= ACTION) continue;
+        if (s < NONTERM) {
+            if (!set[s]) *changed = set[s] = 1;
+            return 0;
+        }
+        for (int t = 0; t < nterms; t++) {
+            if (first[s - NONTERM][t] && !set[t]) *changed = set[t] = 1;
+        }
+        if (!nullable[s - NONTERM]) return 0;
+    }
+    return 1;
+}
+
+void computeSets() {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < nprods; i++) {
+            Production* p = &prods[i];
+            if (firstOf(p, 0, first[p->lhs], &changed) && !nullable[p->lhs]) {
+                changed = nullable[p->lhs] = 1;
+            }
+        }
+    }
+
+    follow[0][nterms - 1] = 1; /* $ follows the start symbol */
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < nprods; i++) {
+            Production* p = &prods[i];
+            for (int j = 0; j < p->len; j++) {
+                int s = p->rhs[j];
+                if (s < NONTERM || s >= ACTION) continue;
+                char* set = follow[s - NONTERM];
+                if (firstOf(p, j + 1, set, &changed)) {
+                    for (int t = 0; t < nterms; t++) {
+                        if (follow[p->lhs][t] && !set[t]) changed = set[t] = 1;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* For the driver's sentence generator, and to catch nonterminals that never
+derive a sentence at all, which are reported and counted in the return value */
+int computeShortest() {
+    int len[MAXNONTERMS];
+    for (int a = 0; a < nnonterms; a++) {
+        len[a] = -1;
+        shortest[a] = -1;
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < nprods; i++) {
+            int n = 0;
+            for (int j = 0; j < prods[i].len && n >= 0; j++) {
+                int s = prods[i].rhs[j];
+                if (s < NONTERM) {
+                    n++;
+                } else if (s < ACTION) {
+                    n = len[s - NONTERM] < 0 ? -1 : n + len[s - NONTERM];
+                }
+            }
+            int a = prods[i].lhs;
+            if (n >= 0 && (len[a] < 0 || n < len[a])) {
+                len[a] = n;
+                shortest[a] = i;
+                changed = 1;
+            }
+        }
+    }
+    int stuck = 0;
+    for (int a = 0; a < nnonterms; a++) {
+        if (len[a] < 0) {
+            fprintf(stderr, "never derives a sentence: %s\n", nonterms[a]);
+            stuck++;
+        }
+    }
+    return stuck;
+}
+
+
+void printSymbol(FILE* f, int s) {
+    if (s >= ACTION) {
+        fprintf(f, "{%s}", actions[s - ACTION]);
+    } else if (s >= NONTERM) {
+        fprintf(f, "%s", nonterms[s - NONTERM]);
+    } else if (terms[s] == '\n') {
+        fprintf(f, "$");
+    } else {
+        fprintf(f, "%c", terms[s]);
+    }
+}
+
+void printProduction(FILE* f, int i) {
+    fprintf(f, "%s ->", nonterms[prods[i].lhs]);
+    if (!prods[i].len) fprintf(f, " ''");
+    for (int j = 0; j < prods[i].len; j++) {
+        fprintf(f, " ");
+        printSymbol(f, prods[i].rhs[j]);
+    }
+}
+
+void printSet(FILE* f, const char* what, int a, char* set) {
+    fprintf(f, "%s(%s) = {", what, nonterms[a]);
+    const char* sep = "";
+    for (int t = 0; t < nterms; t++) {
+        if (!set[t]) continue;
+        fprintf(f, "%s", sep);
+        printSymbol(f, t);
+        sep = ", ";
+    }
+    fprintf(f, "%s}\n", set == first[a] && nullable[a] ? *sep ? ", ''" : "''" : "");
+}
+
+/* M[A, t] for every production A -> x: t in FIRST(x), and FOLLOW(A) if x is nullable */
+int buildTable() {
+    int conflicts = 0;
+    for (int a = 0; a < nnonterms; a++) {
+        for (int t = 0; t < nterms; t++) {
+            table[a][t] = -1;
+        }
+    }
+    for (int i = 0; i < nprods; i++) {
+        Production* p = &prods[i];
+        char set[MAXTERMS] = {0};
+        int changed;
+        if (firstOf(p, 0, set, &changed)) {
+            for (int t = 0; t < nterms; t++) {
+                set[t] |= follow[p->lhs][t];
+            }
+        }
+        for (int t = 0; t < nterms; t++) {
+            if (!set[t]) continue;
+            int *cell = &table[p->lhs][t];
+            if (*cell >= 0 && *cell != i) {
+                fprintf(stderr, "line %d: conflict in M[%s, ", p->line, nonterms[p->lhs]);
+                printSymbol(stderr, t);
+                fprintf(stderr, "] between\n  ");
+                printProduction(stderr, *cell);
+                fprintf(stderr, "\n  ");
+                printProduction(stderr, i);
+                fprintf(stderr, "\n");
+                conflicts++;
+            } else {
+                *cell = i;
+            }
+        }
+    }
+    return conflicts;
+}
+
+
+void writeCString(FILE* f, const char* s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if (*s == '\n') {
+            fprintf(f, "\\n");
+        } else if (*s == '\t') {
+            fprintf(f, "\\t");
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* Right hand sides go in one array, each reversed so the driver can push it in
+order. Symbols are renumbered densely: terminals, nonterminals, then actions */
+void writeTable(FILE* f, const char* grammar) {
+    int nonterm = nterms, action = nterms + nnonterms;
+    fprintf(f, "/* LL(1) table for %s, generated by ll1gen. Don't edit */\n\n", grammar);
+    fprintf(f, "#define LL1_TERMS %d /* Including $, the last */\n", nterms);
+    fprintf(f, "#define LL1_NONTERMS %d\n", nnonterms);
+    fprintf(f, "#define LL1_NONTERM %d /* First nonterminal symbol, the start symbol */\n",
+    nonterm);
+    fprintf(f, "#define LL1_ACTION %d /* First action symbol */\n\n", action);
+
+    fprintf(f, "/* Column of each input byte, -1 if it's not a terminal */\n");
+    fprintf(f, "static const signed char ll1_column[256] = {");
+    for (int c = 0; c < 256; c++) {
+        int col = -1;
+        for (int t = 0; t < nterms; t++) {
+            if ((unsigned char)terms[t] == c) col = t;
+        }
+        fprintf(f, "%s%d,", c % 16 ? " " : "\n    ", col);
+    }
+    fprintf(f, "\n};\n\nstatic const char ll1_terms[] = ");
+    writeCString(f, terms);
+    fprintf(f, ";\n\nstatic const char* const ll1_actions[] = {");
+    for (int i = 0; i < nactions; i++) {
+        fprintf(f, "%s", i ? ", " : "");
+        writeCString(f, actions[i]);
+    }
+    fprintf(f, "%s};\n\n", nactions ? "" : "0");
+
+    fprintf(f, "/* Production i's right hand side, reversed, is ll1_rhs[ll1_start[i]] up to\n"
+    "ll1_rhs[ll1_start[i + 1]] */\nstatic const short ll1_rhs[] = {");
+    int n = 0;
+    for (int i = 0; i < nprods; i++) {
+        for (int j = prods[i].len - 1; j >= 0; j--) {
+            int s = prods[i].rhs[j];
+            s = s >= ACTION ? action + s - ACTION : s >= NONTERM ? nonterm + s - NONTERM : s;
+            fprintf(f, "%s%d,", n++ % 16 ? " " : "\n    ", s);
+        }
+    }
+    fprintf(f, "%s\n};\n\nstatic const short ll1_start[] = {", n ? "" : "0");
+    n = 0;
+    for (int i = 0; i <= nprods; i++) {
+        fprintf(f, "%s%d,", i % 16 ? " " : "\n    ", n);
+        if (i < nprods) n += prods[i].len;
+    }
+
+    fprintf(f, "\n};\n\n/* Nonterminal i's productions are ll1_prods[i] up to ll1_prods[i + 1] */\n");
+    fprintf(f, "static const short ll1_prods[] = {");
+    for (int a = 0, i = 0; a <= nnonterms; a++) {
+        while (i < nprods && prods[i].lhs < a) i++;
+        fprintf(f, "%s%d", a ? ", " : "", i);
+    }
+    fprintf(f, "};\n\n/* Each nonterminal's production that derives the shortest sentence */\n");
+    fprintf(f, "static const short ll1_shortest[] = {");
+    for (int a = 0; a < nnonterms; a++) {
+        fprintf(f, "%s%d", a ? ", " : "", shortest[a]);
+    }
+
+    fprintf(f, "};\n\n/* M[A, t], a production or -1 for a syntax error */\n");
+    fprintf(f, "static const short ll1_table[LL1_NONTERMS][LL1_TERMS] = {\n");
+    for (int a = 0; a < nnonterms; a++) {
+        fprintf(f, "    {");
+        for (int t = 0; t < nterms; t++) {
+            fprintf(f, "%s%d", t ? ", " : "", table[a][t]);
+        }
+        fprintf(f, "}, /* %s */\n", nonterms[a]);
+    }
+    fprintf(f, "};\n");
+}
+
+/* The driver finds a nonterminal's productions as a range, so they're sorted by
+left side, keeping their order otherwise */
+void groupProductions() {
+    Production* sorted = (Production*) malloc(sizeof(Production) * (nprods ? nprods : 1));
+    int n = 0;
+    for (int a = 0; a < nnonterms; a++) {
+        for (int i = 0; i < nprods; i++) {
+            if (prods[i].lhs == a) sorted[n++] = prods[i];
+        }
+    }
+    memcpy(prods, sorted, sizeof(Production) * nprods);
+    free(sorted);
+}
+
+
+int main(int argc, char** argv) {
+    int verbose = 0;
+    const char* in = NULL;
+    const char* out = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        } else if (!in) {
+            in = argv[i];
+        } else if (!out) {
+            out = argv[i];
+        } else {
+            in = NULL;
+            break;
+        }
+    }
+    if (!in) {
+        fprintf(stderr, "Usage: %s [-v] <grammar> [<table.h>]\n", argv[0]);
+        exit(1);
+    }
+
+    FILE* f = fopen(in, "r");
+    if (!f) {
+        perror(in);
+        exit(1);
+    }
+    readGrammar(f);
+    fclose(f);
+    groupProductions();
+    computeSets();
+    int stuck = computeShortest();
+
+    if (verbose) {
+        for (int a = 0; a < nnonterms; a++) {
+            printSet(stderr, "FIRST", a, first[a]);
+        }
+        for (int a = 0; a < nnonterms; a++) {
+            printSet(stderr, "FOLLOW", a, follow[a]);
+        }
+    }
+    int conflicts = buildTable(); /* Even if some are stuck, to report both at once */
+    if (conflicts) {
+        fprintf(stderr, "%s: %d conflict%s, not LL(1)\n", in, conflicts, conflicts > 1 ? "s" : "");
+    }
+    if (stuck || conflicts) exit(1);
+
+    f = out ? fopen(out, "w") : stdout;
+    if (!f) {
+        perror(out);
+        exit(1);
+    }
+    writeTable(f, in);
+    if (f != stdout && fclose(f)) {
+        perror(out);
+        exit(1);
+    }
+    return 0;
+}
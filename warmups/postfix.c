@@ -2,10 +2,25 @@
 Predictive Parser for grammar consisting of single digit addition/subtraction
 as described in the dragon book for compilers.
 Adin Gitig, 4/14/22
+
+-e evaluates instead, with * and / and parentheses too (see the second grammar),
+compiling each line to bytecode for a small stack machine and running it, one result
+per line printed the way Qadin prints "Evaluated to %f". -g N writes N random
+expressions of about -n tokens each to evaluate. So
+
+    ./post -g 100000 -n 50 > exprs.in
+    ./post -e -t exprs.in > post.out
+
+is a baseline in expressions/s for Qadin on the same lines, and post.out what
+Qadin should evaluate them to. Input is read a block at a time, so files can be
+any size.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 /*
 Grammar:
@@ -61,7 +76,324 @@ void expr(char* la) {
     }
 }
 
-int main() {
+/*
+Grammar for -e:
+expr -> expr + term {emit(ADD)}
+      | expr - term {emit(SUB)}
+      | term
+term -> term * factor {emit(MUL)}
+      | term / factor {emit(DIV)}
+      | factor
+factor -> num {emit(LIT num)}
+        | ( expr )
+
+num is digits with an optional point, as Qadin lexes it. Left recursion and all,
+the operator precedence parse in compile handles it with a stack of pending
+operators rather than recursing, so nesting is only limited by memory.
+
+Bytecode is an opcode byte, then for literals the value in as few bytes as it fits:
+one for 0 to 255, four for other integers up to 2^32, and the whole double otherwise.
+*/
+
+enum { OP_HALT, OP_LIT8, OP_LIT32, OP_LITD, OP_ADD, OP_SUB, OP_MUL, OP_DIV };
+
+#define BLOCK (1 << 16)
+
+unsigned char* code = NULL;
+int ncode = 0, capcode = 0;
+char* ops = NULL;        /* The pending operators and ('s */
+int capops = 0;
+double* values = NULL;   /* The machine's stack */
+int capvalues = 0;
+
+void* grow(void* p, int* cap, int need, int size) {
+    if (need <= *cap) return p;
+    while (need > *cap) *cap = *cap ? *cap * 2 : 256;
+    p = realloc(p, (size_t) *cap * size);
+    if (!p) {
+        fprintf(stderr, "grow: failed to allocate\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* compile makes room for the whole line first */
+void emit(const void* bytes, int n) {
+    memcpy(code + ncode, bytes, n);
+    ncode += n;
+}
+
+void emit_op(unsigned char op) {
+    emit(&op, 1);
+}
+
+void emit_lit(double v) {
+    if (v >= 0 && v <= 255 && v == (int) v) {
+        unsigned char b[2] = { OP_LIT8, (uint8_t) v };
+        emit(b, 2);
+    } else if (v >= 0 && v <= UINT32_MAX && v == (uint32_t) v) {
+        uint32_t u = (uint32_t) v;
+        emit_op(OP_LIT32);
+        emit(&u, 4);
+    } else {
+        emit_op(OP_LITD);
+        emit(&v, 8);
+    }
+}
+
+int prec(char op) {
+    return op == '*' || op == '/' ? 2 : op == '+' || op == '-' ? 1 : 0;
+}
+
+unsigned char opcode(char op) {
+    switch (op) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        default: return OP_DIV;
+    }
+}
+
+/* Compiles [s, end) into code, ending in OP_HALT. Returns how deep the machine's
+stack gets, 0 if the line is empty and -1 at a syntax error */
+int compile(const char* s, const char* end) {
+    int nops = 0, depth = 0, maxdepth = 0;
+    int operand = 1;   /* Whether a factor comes next, rather than an operator */
+    /* No character compiles to more than 5 bytes: a literal takes 2 for up to 3
+    digits, 5 from 4 and 9 from 10, or 9 for 2 characters with a point */
+    code = (unsigned char*) grow(code, &capcode, 5 * (end - s) + 1, 1);
+    ops = (char*) grow(ops, &capops, end - s, 1);
+    ncode = 0;
+    for (; s < end; s++) {
+        char c = *s;
+        if (c == ' ' || c == '\t' || c == '\r') continue;
+        if (operand) {
+            if (c == '(') {
+                ops[nops++] = '(';
+            } else if ((c >= '0' && c <= '9') || c == '.') {
+                const char* num = s;
+                uint64_t u = 0;
+                int point = 0;
+                /* Like Qadin's lexer, a literal has one point at most, so 1.2.3 is
+                1.2 and then .3 */
+                while (s < end && ((*s >= '0' && *s <= '9') || (*s == '.' && !point))) {
+                    point |= *s == '.';
+                    u = u * 10 + (*s - '0');
+                    s++;
+                }
+                double v = u;
+                if (point || s - num > 15) {
+                    /* Past 15 digits u can be past what a double holds exactly */
+                    int n = s - num;
+                    char* tmp = (char*) malloc(n + 1);
+                    if (!tmp) {
+                        fprintf(stderr, "compile: failed to allocate\n");
+                        exit(1);
+                    }
+                    memcpy(tmp, num, n);
+                    tmp[n] = 0;
+                    char* used;
+                    v = strtod(tmp, &used);
+                    int whole = used == tmp + n;   /* Not so for a lone . */
+                    free(tmp);
+                    if (!whole) return -1;
+                }
+                s--;
+                emit_lit(v);
+                if (++depth > maxdepth) maxdepth = depth;
+                operand = 0;
+            } else {
+                return -1;
+            }
+        } else if (c == ')') {
+            while (nops && ops[nops - 1] != '(') {
+                emit_op(opcode(ops[--nops]));
+                depth--;
+            }
+            if (!nops) return -1;
+            nops--;
+        } else if (prec(c)) {
+            while (nops && prec(ops[nops - 1]) >= prec(c)) {
+                emit_op(opcode(ops[--nops]));
+                depth--;
+            }
+            ops[nops++] = c;
+            operand = 1;
+        } else {
+            return -1;
+        }
+    }
+    if (operand) return ncode || nops ? -1 : 0;   /* An empty line is fine */
+    while (nops) {
+        if (ops[nops - 1] == '(') return -1;
+        emit_op(opcode(ops[--nops]));
+    }
+    emit_op(OP_HALT);
+    return maxdepth;
+}
+
+/* Runs code on values, which has room for its whole stack. The top of the stack
+lives in tos, and each instruction jumps straight to the next one's handler */
+double run(const unsigned char* pc, double* sp) {
+    static const void* dispatch[] = {
+        &&halt, &&lit8, &&lit32, &&litd, &&add, &&sub, &&mul, &&div,
+    };
+    double tos = 0;
+    #define NEXT goto *dispatch[*pc++]
+    NEXT;
+lit8:
+    *sp++ = tos;
+    tos = *pc++;
+    NEXT;
+lit32: {
+    uint32_t u;
+    memcpy(&u, pc, 4);
+    pc += 4;
+    *sp++ = tos;
+    tos = u;
+    NEXT;
+}
+litd:
+    *sp++ = tos;
+    memcpy(&tos, pc, 8);
+    pc += 8;
+    NEXT;
+add:
+    tos = *--sp + tos;
+    NEXT;
+sub:
+    tos = *--sp - tos;
+    NEXT;
+mul:
+    tos = *--sp * tos;
+    NEXT;
+div:
+    tos = *--sp / tos;
+    NEXT;
+halt:
+    return tos;
+    #undef NEXT
+}
+
+long lines = 0, evaluated = 0, bytes = 0;
+
+/* Returns 0 at a line starting with q, to stop like the translator does */
+int eval_line(const char* s, const char* end) {
+    lines++;
+    if (s < end && *s == 'q') return 0;
+    int depth = compile(s, end);
+    if (depth < 0) {
+        fprintf(stderr, "Syntax Error on line %ld\n", lines);
+    } else if (depth) {
+        values = (double*) grow(values, &capvalues, depth + 1, sizeof(double));
+        printf("%f\n", run(code, values));
+        evaluated++;
+        bytes += ncode;
+    }
+    return 1;
+}
+
+void eval(FILE* in, int report) {
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int cap = 0, len = 0;
+    char* buf = (char*) grow(NULL, &cap, BLOCK, 1);
+    int more = 1;
+    while (more) {
+        int n = fread(buf + len, 1, cap - len, in);
+        if (!n) {
+            if (len) eval_line(buf, buf + len);   /* The last line had no newline */
+            break;
+        }
+        len += n;
+
+        char* line = buf;
+        char* nl;
+        while (more && (nl = (char*) memchr(line, '\n', buf + len - line))) {
+            more = eval_line(line, nl);
+            line = nl + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        buf = (char*) grow(buf, &cap, len + BLOCK, 1);   /* A line longer than a block */
+    }
+    free(buf);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (report) {
+        double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+        fprintf(stderr, "%ld expressions in %.3f ms: %.0f expressions/s, %.1f bytes of code each\n",
+            evaluated, ms, evaluated / (ms / 1e3), evaluated ? (double) bytes / evaluated : 0.0);
+    }
+}
+
+/* Random expressions of about size tokens each, with literals up to 999 and
+parentheses here and there, ending with the q line */
+void generate(int count, int size) {
+    for (int k = 0; k < count; k++) {
+        int open = 0, operand = 1;
+        for (int tokens = 0; operand || tokens < size; tokens++) {
+            if (operand) {
+                if (tokens + open < size && rand() % 4 == 0) {
+                    putchar('(');
+                    open++;
+                } else {
+                    printf("%d", rand() % 1000);
+                    operand = 0;
+                }
+            } else if (open && rand() % 3 == 0) {
+                putchar(')');
+                open--;
+            } else {
+                printf(" %c ", "+-*/"[rand() % 4]);
+                operand = 1;
+            }
+        }
+        while (open--) putchar(')');
+        putchar('\n');
+    }
+    printf("q\n");
+}
+
+
+int main(int argc, char** argv) {
+    int evaluate = 0, report = 0, count = -1, size = 20;
+    const char* file = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e")) {
+            evaluate = 1;
+        } else if (!strcmp(argv[i], "-t")) {
+            report = 1;
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !file) {
+            file = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s [-e [-t] [file] | -g <expressions> [-n <tokens>]]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (count >= 0) {
+        generate(count, size);
+        return 0;
+    }
+    if (evaluate) {
+        FILE* in = file ? fopen(file, "rb") : stdin;
+        if (!in) {
+            fprintf(stderr, "Couldn't open %s\n", file);
+            exit(1);
+        }
+        eval(in, report);
+        if (file) fclose(in);
+        free(code);
+        free(ops);
+        free(values);
+        return 0;
+    }
+
     char lookahead;
     
     while(1) {
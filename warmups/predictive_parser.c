@@ -38,33 +38,55 @@ void match (char t, char* lookahead_ptr) {
     fprintf(stderr, "Syntax Error\n");
 }
 
+/* Each S still to parse is the place its tree goes, and NULL is a ] to print once
+both operands are done. Keeping these on a stack of our own rather than recursing
+means deeply nested input doesn't overflow the C stack */
+Stree*** pending = NULL;
+int npending = 0, cappending = 0;
+
+void pend(Stree** hole) {
+    if (npending == cappending) {
+        cappending = cappending ? cappending * 2 : 64;
+        pending = (Stree***) realloc(pending, sizeof(Stree**) * cappending);
+        if (!pending) {
+            fprintf(stderr, "pend: failed to allocate\n");
+            exit(1);
+        }
+    }
+    pending[npending++] = hole;
+}
+
 Stree* S(char* la) {
-    switch (*la) {
-        case '+':
-            match('+', la);
-            printf("[+");
-            Stree* plustree = emptyNode('+');
-            plustree->left = S(la);
-            plustree->right = S(la);
-            printf("]");
-            return plustree;
-        case '-':
-            match('-', la);
-            printf("[-");
-            Stree* minustree = emptyNode('-');
-            minustree->left = S(la);
-            minustree->right = S(la);
+    Stree* root = NULL;
+    npending = 0;
+    pend(&root);
+    while (npending) {
+        Stree** hole = pending[--npending];
+        if (!hole) {
             printf("]");
-            return minustree;
-        case 'a':
-            match('a', la);
-            printf("a");
-            Stree* atree = emptyNode('a');
-            return atree;
-        default:
-            fprintf(stderr, "Syntax Error\n");
-            return NULL;
+            continue;
+        }
+        switch (*la) {
+            case '+':
+            case '-':
+                printf("[%c", *la);
+                *hole = emptyNode(*la);
+                match(*la, la);
+                pend(NULL);
+                pend(&(*hole)->right);
+                pend(&(*hole)->left);
+                break;
+            case 'a':
+                match('a', la);
+                printf("a");
+                *hole = emptyNode('a');
+                break;
+            default:
+                fprintf(stderr, "Syntax Error\n"); /* And on to the next S, as S() did */
+                break;
+        }
     }
+    return root;
 }
 
 
@@ -103,6 +125,16 @@ int main(int argc, char** argv) {
 
     int grammar = atoi(argv[1]);
 
+    /* Grammar 1 can also draw each tree it parses, into the file given */
+    FILE* trees = NULL;
+    if (argc > 2) {
+        trees = fopen(argv[2], "w");
+        if (!trees) {
+            perror(argv[2]);
+            exit(1);
+        }
+    }
+
     char lookahead;
 
     while(1) {
@@ -113,7 +145,12 @@ int main(int argc, char** argv) {
         }
 
         if (grammar == 1) {
-            S(&lookahead);
+            Stree* t = S(&lookahead);
+            if (trees) {
+                writeTree(t, trees);
+                fprintf(trees, "\n");
+            }
+            freeTree(t);
         } else if (grammar == 2) {
             E(&lookahead);
         } else {
@@ -131,5 +168,6 @@ int main(int argc, char** argv) {
 
         printf("\n\n");
     }
+    if (trees) fclose(trees);
     return 0;
 }
\ No newline at end of file